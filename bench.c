@@ -0,0 +1,374 @@
+#include "umem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define REGION (64 << 20)  // initial umem region, grown by doubling past that
+#define NOPS (200000)      // allocations made by each workload
+#define NSLOTS (4096)      // live blocks a workload keeps at once
+#define BATCH (256)        // blocks allocated before a LIFO or FIFO batch is freed
+#define RING (1024)        // blocks in flight between producer and consumer
+#define LIBC (0)           // policy number of the glibc malloc baseline
+
+typedef struct {
+  const char *name;
+  int algo;
+} policy;
+
+typedef struct {
+  const char *name;
+  void (*run)();
+  int threads;             // threads the workload allocates from
+} workload;
+
+typedef struct {
+  umemhist lat;            // nanoseconds per call
+  size_t ops;
+  double frag;             // umem fragmentation at the fullest point
+} result;
+
+policy POLICIES[] = {
+  {"libc", LIBC},
+  {"first", FIRST_FIT},
+  {"best", BEST_FIT},
+  {"worst", WORST_FIT},
+  {"next", NEXT_FIT},
+  {"buddy", BUDDY},
+};
+#define NPOLICIES (sizeof(POLICIES) / sizeof(policy))
+
+bool USELIBC;
+result RESULT;
+pthread_mutex_t RESULTLOCK = PTHREAD_MUTEX_INITIALIZER;
+unsigned SEED = 1;
+
+// ALLOCATOR FUNCTIONS
+
+uint64_t now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void record(umemhist *hist, uint64_t v){
+  int k = v == 0 ? 0 : 63 - __builtin_clzl(v);
+  hist->count++;
+  hist->sum += v;
+  hist->buckets[k]++;
+}
+
+void mergehist(umemhist *to, umemhist *from){
+  pthread_mutex_lock(&RESULTLOCK);
+  to->count += from->count;
+  to->sum += from->sum;
+  for (int k = 0; k < 64; k++) to->buckets[k] += from->buckets[k];
+  pthread_mutex_unlock(&RESULTLOCK);
+}
+
+/*
+  every call goes through these so that umem and the libc baseline
+  are timed the same way
+*/
+void *balloc(umemhist *lat, size_t size){
+  uint64_t start = now();
+  void *ptr = USELIBC ? malloc(size) : umalloc(size);
+  record(lat, now() - start);
+  if (ptr == NULL) {
+    fprintf(stderr, "out of memory allocating %zu bytes\n", size);
+    exit(1);
+  }
+  // touch the block like a real caller would
+  *(char*) ptr = 1;
+  return ptr;
+}
+
+void bfree(umemhist *lat, void *ptr){
+  uint64_t start = now();
+  if (USELIBC) free(ptr);
+  else ufree(ptr);
+  record(lat, now() - start);
+}
+
+void *brealloc(umemhist *lat, void *ptr, size_t size){
+  uint64_t start = now();
+  void *newptr = USELIBC ? realloc(ptr, size) : urealloc(ptr, size);
+  record(lat, now() - start);
+  if (newptr == NULL) {
+    fprintf(stderr, "out of memory reallocating to %zu bytes\n", size);
+    exit(1);
+  }
+  return newptr;
+}
+
+/*
+  the fragmentation of the heap is sampled at a workload's fullest point
+*/
+void samplefrag(){
+  if (USELIBC) return;
+  umeminfo info = umemstats();
+  if (info.fragmentation > RESULT.frag) RESULT.frag = info.fragmentation;
+}
+
+size_t randsize(size_t min, size_t max){
+  return min + rand_r(&SEED) % (max - min + 1);
+}
+
+// WORKLOAD FUNCTIONS
+
+void constant(){
+  void *slots[NSLOTS];
+  for (int round = 0; round < NOPS / NSLOTS; round++) {
+    for (int i = 0; i < NSLOTS; i++) slots[i] = balloc(&RESULT.lat, 64);
+    if (round == 0) samplefrag();
+    for (int i = 0; i < NSLOTS; i++) bfree(&RESULT.lat, slots[i]);
+  }
+  RESULT.ops = NOPS / NSLOTS * NSLOTS * 2;
+}
+
+void randomsizes(){
+  void *slots[NSLOTS] = {0};
+  size_t ops = 0;
+  for (int i = 0; i < NOPS; i++) {
+    int k = rand_r(&SEED) % NSLOTS;
+    if (slots[k] != NULL) {
+      bfree(&RESULT.lat, slots[k]);
+      ops++;
+    }
+    slots[k] = balloc(&RESULT.lat, randsize(8, 4096));
+    ops++;
+    if (i == NOPS / 2) samplefrag();
+  }
+  for (int k = 0; k < NSLOTS; k++) {
+    if (slots[k] != NULL) bfree(&RESULT.lat, slots[k]);
+  }
+  RESULT.ops = ops + NSLOTS;
+}
+
+void lifo(){
+  void *slots[BATCH];
+  for (int round = 0; round < NOPS / BATCH; round++) {
+    for (int i = 0; i < BATCH; i++) slots[i] = balloc(&RESULT.lat, randsize(16, 512));
+    if (round == 0) samplefrag();
+    for (int i = BATCH - 1; i >= 0; i--) bfree(&RESULT.lat, slots[i]);
+  }
+  RESULT.ops = NOPS / BATCH * BATCH * 2;
+}
+
+void fifo(){
+  void *slots[BATCH];
+  for (int round = 0; round < NOPS / BATCH; round++) {
+    for (int i = 0; i < BATCH; i++) slots[i] = balloc(&RESULT.lat, randsize(16, 512));
+    if (round == 0) samplefrag();
+    for (int i = 0; i < BATCH; i++) bfree(&RESULT.lat, slots[i]);
+  }
+  RESULT.ops = NOPS / BATCH * BATCH * 2;
+}
+
+void reallocheavy(){
+  void *slots[NSLOTS] = {0};
+  size_t sizes[NSLOTS] = {0};
+  size_t ops = 0;
+  for (int i = 0; i < NOPS; i++) {
+    int k = rand_r(&SEED) % NSLOTS;
+    if (slots[k] == NULL) {
+      sizes[k] = randsize(16, 256);
+      slots[k] = balloc(&RESULT.lat, sizes[k]);
+    }
+    else {
+      // mostly grow, sometimes shrink, like a buffer being appended to
+      sizes[k] = rand_r(&SEED) % 4 ? sizes[k] + randsize(1, 256) : sizes[k] / 2 + 1;
+      if (sizes[k] > 16384) sizes[k] = 16;
+      slots[k] = brealloc(&RESULT.lat, slots[k], sizes[k]);
+    }
+    ops++;
+    if (i == NOPS / 2) samplefrag();
+  }
+  for (int k = 0; k < NSLOTS; k++) {
+    if (slots[k] != NULL) bfree(&RESULT.lat, slots[k]);
+  }
+  RESULT.ops = ops + NSLOTS;
+}
+
+/*
+  one block in sixteen lives until the end, the rest are freed soon
+  after they are made, leaving the long lived blocks scattered
+*/
+void mixedlifetimes(){
+  void **kept = malloc(NOPS / 16 * sizeof(void*));
+  void *slots[64] = {0};
+  size_t nkept = 0;
+  size_t ops = 0;
+  for (int i = 0; i < NOPS; i++) {
+    void *ptr = balloc(&RESULT.lat, randsize(16, 1024));
+    ops++;
+    if (i % 16 == 0 && nkept < NOPS / 16) {
+      kept[nkept++] = ptr;
+      continue;
+    }
+    int k = rand_r(&SEED) % 64;
+    if (slots[k] != NULL) {
+      bfree(&RESULT.lat, slots[k]);
+      ops++;
+    }
+    slots[k] = ptr;
+  }
+  samplefrag();
+  for (int k = 0; k < 64; k++) {
+    if (slots[k] != NULL) bfree(&RESULT.lat, slots[k]);
+  }
+  for (size_t i = 0; i < nkept; i++) bfree(&RESULT.lat, kept[i]);
+  free(kept);
+  RESULT.ops = ops + 64 + nkept;
+}
+
+typedef struct {
+  void *ring[RING];
+  size_t head;             // next slot the producer fills
+  size_t tail;             // next slot the consumer empties
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} queue;
+
+void *producer(void *arg){
+  queue *q = arg;
+  umemhist lat = {0};
+  for (int i = 0; i < NOPS; i++) {
+    void *ptr = balloc(&lat, randsize(16, 512));
+    if (i == NOPS / 2) samplefrag();
+    pthread_mutex_lock(&q->lock);
+    while (q->head - q->tail == RING) pthread_cond_wait(&q->changed, &q->lock);
+    q->ring[q->head++ % RING] = ptr;
+    pthread_cond_signal(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+  }
+  mergehist(&RESULT.lat, &lat);
+  return NULL;
+}
+
+void *consumer(void *arg){
+  queue *q = arg;
+  umemhist lat = {0};
+  for (int i = 0; i < NOPS; i++) {
+    pthread_mutex_lock(&q->lock);
+    while (q->head == q->tail) pthread_cond_wait(&q->changed, &q->lock);
+    void *ptr = q->ring[q->tail++ % RING];
+    pthread_cond_signal(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    bfree(&lat, ptr);
+  }
+  mergehist(&RESULT.lat, &lat);
+  return NULL;
+}
+
+/*
+  blocks made on one thread are freed on another
+*/
+void prodcons(){
+  queue q = {.lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER};
+  pthread_t threads[2];
+  pthread_create(&threads[0], NULL, producer, &q);
+  pthread_create(&threads[1], NULL, consumer, &q);
+  pthread_join(threads[0], NULL);
+  pthread_join(threads[1], NULL);
+  RESULT.ops = NOPS * 2;
+}
+
+workload WORKLOADS[] = {
+  {"constant", constant, 1},
+  {"random", randomsizes, 1},
+  {"prodcons", prodcons, 2},
+  {"lifo", lifo, 1},
+  {"fifo", fifo, 1},
+  {"realloc", reallocheavy, 1},
+  {"mixed", mixedlifetimes, 1},
+};
+#define NWORKLOADS (sizeof(WORKLOADS) / sizeof(workload))
+
+// DRIVER FUNCTIONS
+
+/*
+  umeminit can only be called once per process, so each pair of policy
+  and workload runs in a child of its own. The child prints one row.
+  Only workloads with more than one thread pay for THREAD_SAFE
+*/
+int runone(policy *p, workload *w){
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0) {
+    USELIBC = p->algo == LIBC;
+    if (!USELIBC) {
+      umemgrowth(GROW_DOUBLE, 0);
+      int flags = w->threads > 1 ? THREAD_SAFE : 0;
+      if (umeminit(REGION, p->algo | flags) != 0) {
+        fprintf(stderr, "umeminit failed for %s\n", p->name);
+        exit(1);
+      }
+    }
+
+    uint64_t start = now();
+    w->run();
+    double secs = (now() - start) / 1e9;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-8s %-10s %12.0f %8lu %8lu %8lu %10ld ", p->name, w->name, RESULT.ops / secs,
+      umempercentile(&RESULT.lat, 0.5), umempercentile(&RESULT.lat, 0.99),
+      umempercentile(&RESULT.lat, 0.999), usage.ru_maxrss);
+    if (USELIBC) printf("%6s\n", "-");
+    else printf("%6.3f\n", RESULT.frag);
+    fflush(stdout);
+    exit(0);
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+void usage(char *prog){
+  fprintf(stderr, "usage: %s [policy|all] [workload|all]\n", prog);
+  fprintf(stderr, "policies:");
+  for (size_t i = 0; i < NPOLICIES; i++) fprintf(stderr, " %s", POLICIES[i].name);
+  fprintf(stderr, "\nworkloads:");
+  for (size_t i = 0; i < NWORKLOADS; i++) fprintf(stderr, " %s", WORKLOADS[i].name);
+  fprintf(stderr, "\n");
+}
+
+bool matches(char *arg, const char *name){
+  return arg == NULL || strcmp(arg, "all") == 0 || strcmp(arg, name) == 0;
+}
+
+int main(int argc, char *argv[]){
+  char *policyarg = argc > 1 ? argv[1] : NULL;
+  char *workloadarg = argc > 2 ? argv[2] : NULL;
+
+  int runs = 0;
+  int failed = 0;
+  printf("# latencies are p50/p99/p999 in ns, rounded up to a power of two less one\n");
+  printf("%-8s %-10s %12s %8s %8s %8s %10s %6s\n",
+    "policy", "workload", "ops/sec", "p50", "p99", "p999", "maxrss_kb", "frag");
+  fflush(stdout);
+  for (size_t i = 0; i < NPOLICIES; i++) {
+    if (!matches(policyarg, POLICIES[i].name)) continue;
+    for (size_t j = 0; j < NWORKLOADS; j++) {
+      if (!matches(workloadarg, WORKLOADS[j].name)) continue;
+      runs++;
+      if (runone(&POLICIES[i], &WORKLOADS[j]) != 0) failed++;
+    }
+  }
+
+  if (runs == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  return failed == 0 ? 0 : 1;
+}
@@ -5,20 +5,33 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <time.h>
+#include <pthread.h>
 
 #define NUM (0)
 #define ADDR (1)
 #define SIZE (2)
 #define FREE (3)
+#ifndef HARDENING
+#define HARDENING (1)
+#endif
+#if HARDENING
 #define hsize (32)
 #define usedhsize (16)
 #define fsize (8)
 #define hfsize (40)
-#define usedhfsize (24)
+#define usedhfsize (16) // used blocks have no footer
+#else
+#define hsize (24)
+#define usedhsize (8)
+#define fsize (8)
+#define hfsize (32)
+#define usedhfsize (8)
+#endif
 
 typedef struct {
   int valid;
@@ -47,7 +60,7 @@ void dumptofile(){
   close(fd);
 }
 
-int dumpandparse(){
+int parsedump(){
   memset(memlog, 0, 1000);
   dumptofile();
 
@@ -58,7 +71,6 @@ int dumpandparse(){
   }
 
   size_t size = 0;
-  ssize_t len = 0;
   char *line = NULL;
 
   int n = 0;
@@ -79,7 +91,24 @@ int dumpandparse(){
 
   fclose(f);
   free(line);
-  return len;
+  return n;
+}
+
+int logfree(const umemblock *block, void *ctx){
+  int *n = ctx;
+  if (block->free) {
+    memlog[*n] = (header) {1, *n, block->addr, block->size, block->free};
+    (*n)++;
+  }
+  return 0;
+}
+
+int dumpandparse(){
+  // same entries as parsedump, read straight from the heap
+  memset(memlog, 0, 1000);
+  int n = 0;
+  umemwalk(logfree, &n);
+  return n;
 }
 
 int lenfreelist(){
@@ -98,6 +127,55 @@ size_t calctotalsize(){
   return totalsize;
 }
 
+int countresident(void *addr, size_t len){
+  size_t page = getpagesize();
+  char *start = (char*) ((size_t) addr / page * page);
+  len += (char*) addr - start;
+  size_t npages = (len + page - 1) / page;
+  unsigned char vec[npages];
+  if (mincore(start, len, vec) != 0) {
+    perror("mincore");
+    exit(1);
+  }
+  int n = 0;
+  for (size_t i = 0; i < npages; i++) n += vec[i] & 1;
+  return n;
+}
+
+int ismappedaddr(void *addr){
+  size_t page = getpagesize();
+  unsigned char vec;
+  return mincore((void*) ((size_t) addr / page * page), page, &vec) == 0;
+}
+
+int checkstats(){
+  // the counters kept by umemstats agree with a walk of the free blocks
+  umeminfo info = umemstats();
+  int n = lenfreelist();
+  size_t free = 0;
+  size_t largest = 0;
+  size_t classes[64] = {0};
+  for (int i = 0; i < n; i++) {
+    size_t bsize = memlog[i].size + hsize + fsize;
+    free += bsize;
+    if (bsize > largest) largest = bsize;
+    classes[63 - __builtin_clzl(bsize)]++;
+  }
+  if (info.freeblocks != (size_t) n || info.free != free) return 0;
+  // the largest free block is exact when no other block shares its
+  // class, and otherwise no more than the largest in that class
+  if (n > 0) {
+    int top = 63 - __builtin_clzl(largest);
+    if (info.largestfree > largest || info.largestfree < (size_t) 1 << top) return 0;
+    if (classes[top] == 1 && info.largestfree != largest) return 0;
+  }
+  if (info.inuse + info.free != info.heapsize) return 0;
+  for (int k = 0; k < 64; k++) {
+    if (info.freeclasses[k] != classes[k]) return 0;
+  }
+  return 1;
+}
+
 int malloc_until_full(size_t *totalsize, size_t *blocksize, int *n){
   if (*n < 1){
     *totalsize = calctotalsize();
@@ -200,7 +278,7 @@ int malloc_twice(){
   if (p1 == NULL || p2 == NULL) return 0; // malloc gives valid pointers
   if ((unsigned long) p1 % 8  != 0) return 0; // pointer is aligned on 8-byte boundary
   if ((unsigned long) p2 % 8 != 0) return 0;
-  if (p2 - p1 != 16 + usedhfsize) return 0; // malloc upsizes correctly
+  if (p2 - p1 != 24 + usedhfsize) return 0; // malloc upsizes to fit a free header and footer
   return 1;
 }
 
@@ -281,6 +359,8 @@ int free_invalid_ptr(){
   umeminit(1, FIRST_FIT);
   dumpandparse();
   void *p = umalloc(1) + 10;
+  // without the magic number an invalid pointer cannot be told apart
+  if (!HARDENING) return 1;
   return ufree(p) == -1;
 }
 
@@ -336,7 +416,8 @@ int malloc_full_then_free_forwards(){
     p += blocksize;
   }
 
-  if (ufree(p) != -1) return 0;
+  // only the magic number shows that p is not a block
+  if (HARDENING && ufree(p) != -1) return 0;
 
   return 1;
 }
@@ -397,6 +478,31 @@ int best_fit(){
   return 1;
 }
 
+int best_fit_many(){
+  // with many free fragments of different sizes the exact fit
+  // is chosen over every larger fragment
+  umeminit(200000, BEST_FIT);
+
+  int nfrags = 200;
+  void *frags[200];
+  for (int i = 0; i < nfrags; i++) {
+    // sizes are spread out of address order
+    frags[i] = umalloc(16 + 8 * ((i * 37) % nfrags));
+    if (frags[i] == NULL) return 0;
+    if (umalloc(1) == NULL) return 0;
+  }
+  for (int i = 0; i < nfrags; i++) {
+    if (ufree(frags[i]) != 0) return 0;
+  }
+  if (lenfreelist() != nfrags + 1) return 0;
+
+  for (int i = 0; i < nfrags; i += 7) {
+    void *p = umalloc(16 + 8 * ((i * 37) % nfrags));
+    if (p != frags[i]) return 0;
+  }
+  return 1;
+}
+
 int worst_fit(){
   /*
     Start
@@ -485,6 +591,1395 @@ int next_fit_wrapping(){
   return 1;
 }
 
+int buddy_split_merge(){
+  // a single small request splits the page down to the smallest order
+  // and freeing it merges every buddy back into one block
+  umeminit(1, BUDDY);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+  if (initialsize != getpagesize() - hfsize) return 0;
+
+  void *p = umalloc(1);
+  if (p == NULL) return 0;
+  if ((unsigned long) p % 8 != 0) return 0;
+  if (lenfreelist() != 6) return 0; // 64, 128, ..., 2048 byte buddies
+
+  if (ufree(p) != 0) return 0;
+  if (lenfreelist() != 1) return 0;
+  if (memlog[0].size != initialsize) return 0;
+  return 1;
+}
+
+int buddy_power_of_two(){
+  // requests that fill a power of two exactly use the whole block
+  umeminit(1, BUDDY);
+  size_t blocksize = getpagesize() / 4;
+  void *ptrs[4];
+  for (int i = 0; i < 4; i++) {
+    ptrs[i] = umalloc(blocksize - usedhfsize);
+    if (ptrs[i] == NULL) return 0;
+    if (i > 0 && ptrs[i] - ptrs[i-1] != blocksize) return 0;
+  }
+  if (umalloc(1) != NULL) return 0;
+  if (lenfreelist() != 0) return 0;
+
+  // free out of order so merges happen in both directions
+  if (ufree(ptrs[1]) != 0 || ufree(ptrs[2]) != 0) return 0;
+  if (lenfreelist() != 2) return 0;
+  if (ufree(ptrs[0]) != 0 || ufree(ptrs[3]) != 0) return 0;
+  if (lenfreelist() != 1) return 0;
+  return 1;
+}
+
+int segregated_reuse(){
+  // freed fragments are found again through their size class
+  // and coalesce back into one block using only boundary tags
+  umeminit(10000, SEGREGATED);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  void *ptrs[8];
+  for (int i = 0; i < 8; i++) {
+    ptrs[i] = umalloc(i % 2 ? 24 : 1000);
+    if (ptrs[i] == NULL) return 0;
+  }
+  for (int i = 0; i < 8; i += 2) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  if (lenfreelist() != 5) return 0; // four fragments and the tail
+
+  void *p = umalloc(1000);
+  if (p != ptrs[0] && p != ptrs[2] && p != ptrs[4] && p != ptrs[6]) return 0;
+  if (lenfreelist() != 4) return 0;
+  if (ufree(p) != 0) return 0;
+
+  for (int i = 1; i < 8; i += 2) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  if (lenfreelist() != 1) return 0;
+  if (memlog[0].size != initialsize) return 0;
+  return 1;
+}
+
+int stress_test_segregated(){
+  umeminit(10000, SEGREGATED);
+  return stress_test(1000);
+}
+
+int lifo_fit(){
+  // the most recently freed block is reused first, even though
+  // an earlier block in memory also fits
+  umeminit(10000, LIFO_FIT);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  void *p1 = umalloc(100);
+  void *s1 = umalloc(1);
+  void *p2 = umalloc(100);
+  void *s2 = umalloc(1);
+
+  if (ufree(p1) != 0 || ufree(p2) != 0) return 0;
+  if (lenfreelist() != 3) return 0;
+  if (umalloc(100) != p2) return 0;
+  if (ufree(p2) != 0) return 0;
+
+  if (ufree(s1) != 0 || ufree(s2) != 0) return 0;
+  if (lenfreelist() != 1) return 0;
+  if (memlog[0].size != initialsize) return 0;
+  return 1;
+}
+
+int stress_test_lifo_fit(){
+  umeminit(10000, LIFO_FIT);
+  return stress_test(1000);
+}
+
+int grow_fixed(){
+  // once the region is full new chunks are mapped, and blocks
+  // in different chunks never coalesce with each other
+  umemgrowth(GROW_FIXED, 0);
+  umeminit(1, FIRST_FIT);
+
+  void *ptrs[8];
+  for (int i = 0; i < 8; i++) {
+    ptrs[i] = umalloc(getpagesize() - usedhfsize); // fills a chunk exactly
+    if (ptrs[i] == NULL) return 0;
+  }
+  if (lenfreelist() != 0) return 0;
+
+  for (int i = 0; i < 8; i++) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  if (lenfreelist() != 8) return 0;
+  for (int i = 0; i < 8; i++) {
+    if (memlog[i].size != getpagesize() - hfsize) return 0;
+  }
+  return 1;
+}
+
+int grow_limit(){
+  // chunks double the heap until the limit is reached
+  int page = getpagesize();
+  umemgrowth(GROW_DOUBLE, 4 * page);
+  umeminit(1, SEGREGATED);
+
+  for (int i = 0; i < 4; i++) {
+    if (umalloc(page - usedhfsize) == NULL) return 0;
+  }
+  if (umalloc(page - usedhfsize) != NULL) return 0;
+  return 1;
+}
+
+int grow_buddy(){
+  // requests larger than the initial region get a chunk that fits them
+  umemgrowth(GROW_FIXED, 0);
+  umeminit(1, BUDDY);
+
+  void *p = umalloc(4 * getpagesize() - usedhfsize);
+  if (p == NULL) return 0;
+  if (lenfreelist() != 1) return 0;
+  if (ufree(p) != 0) return 0;
+  if (lenfreelist() != 2) return 0;
+  return 1;
+}
+
+int trim_explicit(){
+  // umemtrim releases the pages inside free blocks and
+  // unmaps chunks that have nothing in use
+  int page = getpagesize();
+  umemgrowth(GROW_FIXED, 0);
+  umeminit(16 * page, FIRST_FIT);
+
+  size_t len = 12 * page;
+  void *p1 = umalloc(len);
+  void *p2 = umalloc(len); // goes in a new chunk
+  if (p1 == NULL || p2 == NULL) return 0;
+  memset(p1, 1, len);
+  memset(p2, 1, len);
+  if (ufree(p1) != 0 || ufree(p2) != 0) return 0;
+  if (lenfreelist() != 2) return 0;
+  if (countresident(p1, len) < 11) return 0;
+
+  if (umemtrim() < 11 * page) return 0;
+  if (countresident(p1, len) > 1) return 0;
+  if (lenfreelist() != 1) return 0;
+
+  // trimmed memory is still usable
+  p1 = umalloc(len);
+  if (p1 == NULL) return 0;
+  memset(p1, 1, len);
+  return ufree(p1) == 0;
+}
+
+int trim_threshold(){
+  // ufree trims blocks over the threshold as soon as they are freed
+  int page = getpagesize();
+  umeminit(16 * page, SEGREGATED);
+  umemtrimthreshold(4 * page);
+
+  size_t len = 8 * page;
+  void *small = umalloc(2 * page);
+  void *big = umalloc(len);
+  umalloc(1); // keeps the tail from coalescing with big
+  memset(small, 1, 2 * page);
+  memset(big, 1, len);
+
+  if (ufree(small) != 0) return 0;
+  if (countresident(small, 2 * page) < 2) return 0;
+  if (ufree(big) != 0) return 0;
+  if (countresident(big, len) > 2) return 0;
+  return 1;
+}
+
+int thread_cache(){
+  // small blocks are served from the thread cache in LIFO order,
+  // and double frees are still caught
+  umeminit(1, FIRST_FIT | THREAD_SAFE);
+  void *p = umalloc(32);
+  if (p == NULL) return 0;
+  if (ufree(p) != 0) return 0;
+  if (umalloc(32) != p) return 0;
+  if (ufree(p) != 0) return 0;
+  if (ufree(p) != -1) return 0;
+  return 1;
+}
+
+void *thread_worker(void *arg){
+  unsigned int seed = (unsigned long) arg;
+  int nptrs = 64;
+  char *ptrs[64] = {NULL};
+  size_t sizes[64];
+
+  for (int i = 0; i < 20000; i++) {
+    int idx = rand_r(&seed) % nptrs;
+    if (ptrs[idx] != NULL) {
+      // no other thread may have written into this block
+      for (size_t j = 0; j < sizes[idx]; j++) {
+        if (ptrs[idx][j] != (char) idx) return NULL;
+      }
+      if (ufree(ptrs[idx]) != 0) return NULL;
+      ptrs[idx] = NULL;
+    }
+    else {
+      sizes[idx] = 1 + rand_r(&seed) % (rand_r(&seed) % 4 ? 200 : 2000);
+      ptrs[idx] = umalloc(sizes[idx]);
+      if (ptrs[idx] == NULL) return NULL;
+      memset(ptrs[idx], idx, sizes[idx]);
+    }
+  }
+  for (int i = 0; i < nptrs; i++) {
+    if (ufree(ptrs[i]) != 0) return NULL;
+  }
+  return arg;
+}
+
+int threads_concurrent(){
+  // many threads allocate and free at once, and everything they cached
+  // is back in the heap after they exit
+  umeminit(1 << 22, SEGREGATED | THREAD_SAFE);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  int nthreads = 8;
+  pthread_t threads[8];
+  for (long i = 0; i < nthreads; i++) {
+    pthread_create(&threads[i], NULL, thread_worker, (void*) (i + 1));
+  }
+  int rc = 1;
+  for (int i = 0; i < nthreads; i++) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    if (ret == NULL) rc = 0;
+  }
+
+  if (lenfreelist() != 1) return 0;
+  if (memlog[0].size != initialsize) return 0;
+  return rc;
+}
+
+void *arena_alloc(void *arg){
+  // large enough to skip the thread cache
+  return umalloc(1000);
+}
+
+int arenas_separate(){
+  // threads allocate from different arenas, and a block freed by
+  // another thread goes back to the arena that owns it
+  int narenas = 4;
+  size_t region = 1 << 20;
+  umemarenas(narenas);
+  umeminit(region, SEGREGATED | THREAD_SAFE);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+  if (lenfreelist() != narenas) return 0;
+
+  char *ptrs[4];
+  for (int i = 0; i < narenas; i++) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, arena_alloc, NULL);
+    pthread_join(thread, (void**) &ptrs[i]);
+    if (ptrs[i] == NULL) return 0;
+  }
+  for (int i = 0; i < narenas; i++) {
+    for (int j = 0; j < i; j++) {
+      size_t dist = ptrs[i] > ptrs[j] ? ptrs[i] - ptrs[j] : ptrs[j] - ptrs[i];
+      if (dist < region / narenas) return 0;
+    }
+  }
+
+  for (int i = 0; i < narenas; i++) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  if (lenfreelist() != narenas) return 0;
+  for (int i = 0; i < narenas; i++) {
+    if (memlog[i].size != initialsize) return 0;
+  }
+  return 1;
+}
+
+int threads_arenas(){
+  // the concurrent workload spread over several arenas leaves
+  // every arena with one free block once all threads exit
+  int narenas = 4;
+  umemarenas(narenas);
+  umeminit(1 << 23, BEST_FIT | THREAD_SAFE);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  pthread_t threads[8];
+  for (long i = 0; i < 8; i++) {
+    pthread_create(&threads[i], NULL, thread_worker, (void*) (i + 1));
+  }
+  int rc = 1;
+  for (int i = 0; i < 8; i++) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    if (ret == NULL) rc = 0;
+  }
+
+  if (lenfreelist() != narenas) return 0;
+  for (int i = 0; i < narenas; i++) {
+    if (memlog[i].size != initialsize) return 0;
+  }
+  return rc;
+}
+
+int heaps_separate(){
+  // heaps from umemcreate keep their own blocks and refuse
+  // pointers that belong to another heap
+  umemheap *a = umemcreate(4096, FIRST_FIT);
+  umemheap *b = umemcreate(4096, BEST_FIT);
+  if (a == NULL || b == NULL) return 0;
+
+  char *pa = umemalloc(a, 100);
+  char *pb = umemalloc(b, 100);
+  if (pa == NULL || pb == NULL) return 0;
+  memset(pa, 'a', 100);
+  memset(pb, 'b', 100);
+
+  if (umemfree(a, pb) != -1) return 0;
+  if (umemfree(b, pa) != -1) return 0;
+  if (ufree(pa) != -1) return 0;
+  if (pa[99] != 'a' || pb[99] != 'b') return 0;
+
+  if (umemfree(a, pa) != 0) return 0;
+  if (umemfree(a, pa) != -1) return 0;
+  if (umemfree(b, pb) != 0) return 0;
+  return umemdestroy(a) == 0 && umemdestroy(b) == 0;
+}
+
+int heaps_destroy(){
+  // destroying a heap discards all of its blocks and leaves
+  // the default heap and other heaps untouched
+  umeminit(4096, FIRST_FIT);
+  umemheap *a = umemcreate(4096, SEGREGATED);
+  umemheap *b = umemcreate(4096, BUDDY | THREAD_SAFE);
+  if (a == NULL || b == NULL) return 0;
+
+  char *p = umalloc(100);
+  for (int i = 0; i < 10; i++) {
+    if (umemalloc(a, 200) == NULL) return 0;
+  }
+  char *pb = umemalloc(b, 200);
+  if (p == NULL || pb == NULL) return 0;
+  if (umemdestroy(a) != 0) return 0;
+
+  memset(pb, 1, 200);
+  memset(p, 1, 100);
+  if (umemfree(b, pb) != 0) return 0;
+  if (umemdestroy(b) != 0) return 0;
+  if (ufree(p) != 0) return 0;
+  dumpandparse();
+  return lenfreelist() == 1;
+}
+
+int heaps_invalid(){
+  // bad parameters are refused, and the arenas cannot be destroyed
+  if (umemcreate(0, FIRST_FIT) != NULL) return 0;
+  if (umemcreate(4096, 42) != NULL) return 0;
+  if (umemalloc(NULL, 10) != NULL) return 0;
+  if (umemdestroy(NULL) != -1) return 0;
+
+  umemheap *a = umemcreate(4096, NEXT_FIT);
+  if (a == NULL || umemalloc(a, 0) != NULL) return 0;
+  if (umemfree(a, NULL) != 0) return 0;
+  return umemdestroy(a) == 0;
+}
+
+int reset_heap(){
+  // a reset discards every block, including the chunks the heap grew
+  // by, and leaves the same single free block umeminit made
+  int page = getpagesize();
+  umemgrowth(GROW_FIXED, 0);
+  umeminit(page, BEST_FIT);
+  dumpandparse();
+  void *first = memlog[0].addr;
+  size_t initialsize = memlog[0].size;
+
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 20; i++) {
+      if (umalloc(500) == NULL) return 0;
+    }
+    if (umemreset() != 0) return 0;
+    dumpandparse();
+    if (lenfreelist() != 1) return 0;
+    if (memlog[0].addr != first || memlog[0].size != initialsize) return 0;
+  }
+  return 1;
+}
+
+int reset_bump(){
+  // until something is freed, each block starts right after the last
+  umeminit(4096, SEGREGATED);
+  char *first = umalloc(24);
+  char *prev = first;
+  for (int i = 1; i <= 10; i++) {
+    char *ptr = umalloc(24 + 8 * i);
+    if (ptr != prev + 24 + 8 * (i - 1) + usedhfsize) return 0;
+    prev = ptr;
+  }
+
+  // after a free the algorithm takes over and reuses the block
+  if (ufree(prev) != 0) return 0;
+  if (umalloc(104) != prev) return 0;
+
+  // and a reset starts again from the front of the region
+  if (umemreset() != 0) return 0;
+  return umalloc(24) == first;
+}
+
+int reset_threads(){
+  // blocks in the thread cache from before a reset are dropped
+  umeminit(4096, FIRST_FIT | THREAD_SAFE);
+  void *ptrs[10];
+  for (int i = 0; i < 10; i++) {
+    ptrs[i] = umalloc(16);
+    if (ptrs[i] == NULL) return 0;
+  }
+  for (int i = 0; i < 10; i++) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  if (umemreset() != 0) return 0;
+
+  char *a = umalloc(16);
+  char *b = umalloc(16);
+  return a == ptrs[0] && b != NULL && b != a;
+}
+
+int reset_created(){
+  // umemclear does the same for a heap from umemcreate
+  umemheap *hp = umemcreate(4096, WORST_FIT);
+  if (hp == NULL) return 0;
+  char *first = umemalloc(hp, 100);
+  for (int i = 0; i < 10; i++) {
+    if (umemalloc(hp, 100) == NULL) return 0;
+  }
+  if (umemclear(hp) != 0) return 0;
+  if (umemalloc(hp, 4000) != first) return 0;
+  return umemdestroy(hp) == 0;
+}
+
+int realloc_shrink(){
+  // shrinking gives the tail of the block back as a free block
+  umeminit(4096, BEST_FIT);
+  char *a = umalloc(1000);
+  char *b = umalloc(100);
+  memset(a, 'a', 1000);
+  memset(b, 'b', 100);
+  if (urealloc(a, 200) != a) return 0;
+  // the start of the data is right after the header, so check all of it
+  for (int i = 0; i < 200; i++) {
+    if (a[i] != 'a') return 0;
+  }
+  dumpandparse();
+  if (lenfreelist() != 2) return 0;
+  if (memlog[0].addr != a + 200 || memlog[0].size != 1000 - 200 - hfsize) return 0;
+
+  // and when the tail is next to the rest of the free space they join
+  if (urealloc(b, 16) != b) return 0;
+  for (int i = 0; i < 16; i++) {
+    if (b[i] != 'b') return 0;
+  }
+  dumpandparse();
+  return lenfreelist() == 2 && memlog[1].addr == b + 24; // 16 is rounded up to 24
+}
+
+int realloc_grow(){
+  // growing absorbs the free block after it without moving
+  umeminit(4096, FIRST_FIT);
+  char *a = umalloc(100);
+  char *b = umalloc(500);
+  char *c = umalloc(100);
+  memset(a, 'a', 100);
+  memset(c, 'c', 100);
+  if (ufree(b) != 0) return 0;
+  if (urealloc(a, 304) != a) return 0;
+  for (int i = 0; i < 100; i++) {
+    if (a[i] != 'a') return 0;
+  }
+  dumpandparse();
+  if (memlog[0].addr != a + 304) return 0;
+
+  // a vector growing at the end of the heap never moves
+  for (size_t size = 200; size < 3000; size += 100) {
+    if (urealloc(c, size) != c) return 0;
+  }
+  for (int i = 0; i < 100; i++) {
+    if (c[i] != 'c') return 0;
+  }
+  return 1;
+}
+
+int realloc_move(){
+  // without room after the block the data is copied to a new one
+  umeminit(4096, SEGREGATED);
+  char *a = umalloc(100);
+  char *b = umalloc(100);
+  for (int i = 0; i < 100; i++) a[i] = i;
+  char *c = urealloc(a, 1000);
+  if (c == NULL || c == a) return 0;
+  for (int i = 0; i < 100; i++) {
+    if (c[i] != i) return 0;
+  }
+  if (urealloc(NULL, 10) == NULL) return 0;
+  if (urealloc(b, 0) != NULL) return 0;
+  return ufree(b) == -1;
+}
+
+int iszero(char *p, size_t len){
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] != 0) return 0;
+  }
+  return 1;
+}
+
+int calloc_fresh(){
+  // memory straight from mmap is not touched by ucalloc
+  size_t len = 1 << 21;
+  umeminit(2 * len, FIRST_FIT);
+  char *p = ucalloc(len / 8, 8);
+  if (p == NULL) return 0;
+  if (countresident(p, len) > 2) return 0;
+  if (!iszero(p, len)) return 0;
+
+  // but memory that has been used is cleared
+  memset(p, 1, len);
+  if (ufree(p) != 0) return 0;
+  p = ucalloc(1, len);
+  if (p == NULL || !iszero(p, len)) return 0;
+  return 1;
+}
+
+int calloc_trim(){
+  // trimmed memory reads back as zero and is not touched either
+  size_t len = 1 << 20;
+  umeminit(2 * len, BEST_FIT);
+  char *small = umalloc(100);
+  char *p = umalloc(len);
+  memset(small, 1, 100);
+  memset(p, 1, len);
+  if (ufree(small) != 0 || ufree(p) != 0) return 0;
+  umemtrim();
+
+  p = ucalloc(1, len);
+  if (p == NULL) return 0;
+  if (countresident(p, len) > 2) return 0;
+  return iszero(p, len);
+}
+
+int calloc_small(){
+  // small blocks come from the thread cache and are always cleared
+  umeminit(4096, SEGREGATED | THREAD_SAFE);
+  char *p = umalloc(32);
+  memset(p, 1, 32);
+  if (ufree(p) != 0) return 0;
+  char *q = ucalloc(4, 8);
+  if (q != p || !iszero(q, 32)) return 0;
+  return ucalloc((size_t) -1, 2) == NULL && ucalloc(0, 8) == NULL;
+}
+
+int align_sizes(){
+  // every supported alignment is honoured and the slack is given back
+  size_t alignments[] = {16, 32, 64, 4096};
+  umeminit(1 << 16, BEST_FIT);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  for (int round = 0; round < 2; round++) {
+    char *ptrs[4];
+    for (int i = 0; i < 4; i++) {
+      ptrs[i] = umemalign(alignments[i], 100 + i);
+      if (ptrs[i] == NULL || (size_t) ptrs[i] % alignments[i] != 0) return 0;
+      memset(ptrs[i], 1, 100 + i);
+    }
+    for (int i = 0; i < 4; i++) {
+      if (ufree(ptrs[i]) != 0) return 0;
+    }
+    dumpandparse();
+    if (lenfreelist() != 1 || memlog[0].size != initialsize) return 0;
+  }
+  return 1;
+}
+
+int align_slack(){
+  // the slack in front of an aligned block is a free block that gets reused
+  umeminit(4096, FIRST_FIT);
+  char *first = umalloc(24);
+  char *p = umemalign(256, 200);
+  if (p == NULL || (size_t) p % 256 != 0) return 0;
+  dumpandparse();
+  if (lenfreelist() != 2) return 0;
+  if ((char*) memlog[0].addr != first + 24) return 0;
+  char *q = umalloc(memlog[0].size);
+  return q > first && q < p;
+}
+
+int align_invalid(){
+  // alignments that are not powers of two are refused, and BUDDY
+  // only aligns as far as its headers allow
+  umeminit(4096, BUDDY);
+  if (umemalign(24, 100) != NULL) return 0;
+  if (umemalign(0, 100) != NULL) return 0;
+  if (umemalign(64, 100) != NULL) return 0;
+  char *p = umemalign(usedhsize, 100);
+  return p != NULL && (size_t) p % usedhsize == 0;
+}
+
+int batch_alloc(){
+  // a batch is carved from one free block, one block after another
+  umeminit(1 << 16, BEST_FIT);
+  void *ptrs[64];
+  if (umallocbatch(100, 64, ptrs) != 64) return 0;
+  for (int i = 1; i < 64; i++) {
+    if ((char*) ptrs[i] != (char*) ptrs[i - 1] + 104 + usedhfsize) return 0;
+  }
+  for (int i = 0; i < 64; i++) {
+    memset(ptrs[i], i, 100);
+  }
+  dumpandparse();
+  if (lenfreelist() != 1) return 0;
+
+  // the blocks are ordinary blocks once allocated
+  for (int i = 0; i < 64; i += 2) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  dumpandparse();
+  return lenfreelist() == 33;
+}
+
+int batch_free(){
+  // a batch in any order is freed back into a single block
+  umeminit(1 << 16, FIRST_FIT);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  void *ptrs[64];
+  for (int i = 0; i < 64; i++) {
+    ptrs[i] = umalloc(50 + i);
+  }
+  for (int i = 0; i < 64; i++) {
+    int j = rand() % 64;
+    void *tmp = ptrs[i];
+    ptrs[i] = ptrs[j];
+    ptrs[j] = tmp;
+  }
+  if (ufreebatch(ptrs, 64) != 0) return 0;
+  dumpandparse();
+  return lenfreelist() == 1 && memlog[0].size == initialsize;
+}
+
+int batch_invalid(){
+  // bad and repeated pointers are skipped, the rest are still freed
+  umeminit(4096, SEGREGATED);
+  void *ptrs[6];
+  if (umallocbatch(64, 4, ptrs) != 4) return 0;
+  if (ufree(ptrs[3]) != 0) return 0;
+  ptrs[4] = ptrs[0];
+  ptrs[5] = NULL;
+  if (ufreebatch(ptrs, 6) != -1) return 0;
+  dumpandparse();
+  if (lenfreelist() != 1) return 0;
+
+  // a heap too small for the whole batch still fills what it can
+  void *big[9];
+  return umallocbatch(1000, 9, big) == 8;
+}
+
+int slab_small(){
+  // small requests are packed into slabs without any headers
+  // and leave the blocks of the heap alone
+  umeminit(4096, FIRST_FIT | SLAB);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  char *ptrs[100];
+  for (int i = 0; i < 100; i++) {
+    ptrs[i] = umalloc(8);
+    if (ptrs[i] == NULL) return 0;
+    if (i > 0 && ptrs[i] != ptrs[i - 1] + 8) return 0;
+    memset(ptrs[i], i, 8);
+  }
+  dumpandparse();
+  if (lenfreelist() != 1 || memlog[0].size != initialsize) return 0;
+
+  for (int i = 0; i < 100; i++) {
+    if (ptrs[i][7] != (char) i) return 0;
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  if (ufree(ptrs[50]) != -1) return 0;
+  if (ufree(ptrs[50] + 1) != -1) return 0;
+  return umalloc(16) == ptrs[0];
+}
+
+int slab_fallthrough(){
+  // larger requests still come from blocks, and objects move
+  // out of their slab when they grow
+  umeminit(4096, BEST_FIT | SLAB);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  char *big = umalloc(65);
+  char *small = umalloc(40);
+  dumpandparse();
+  if (memlog[0].size == initialsize) return 0;
+
+  memset(small, 1, 40);
+  if (urealloc(small, 32) != small) return 0;
+  char *moved = urealloc(small, 200);
+  if (moved == NULL || moved == small || moved[39] != 1) return 0;
+  if (ufree(small) != -1) return 0;
+
+  void *ptrs[] = {moved, umalloc(8), big, umalloc(64)};
+  if (ufreebatch(ptrs, 4) != 0) return 0;
+  dumpandparse();
+  return lenfreelist() == 1 && memlog[0].size == initialsize;
+}
+
+int slab_threads(){
+  // slabs are shared between threads like the rest of an arena
+  umemarenas(2);
+  umeminit(1 << 22, SEGREGATED | THREAD_SAFE | SLAB);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  int nthreads = 8;
+  pthread_t threads[8];
+  for (long i = 0; i < nthreads; i++) {
+    pthread_create(&threads[i], NULL, thread_worker, (void*) (i + 1));
+  }
+  int rc = 1;
+  for (int i = 0; i < nthreads; i++) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    if (ret == NULL) rc = 0;
+  }
+
+  dumpandparse();
+  if (lenfreelist() != 2 || memlog[0].size != initialsize) return 0;
+  return rc;
+}
+
+int align_buddy_slab(){
+  // aligned requests under BUDDY skip the slabs, whose objects are
+  // only aligned to the minimum alignment
+  umeminit(1 << 16, BUDDY | SLAB);
+  for (int i = 0; i < 16; i++) {
+    char *p = umemalign(usedhsize, 24);
+    if (p == NULL || (size_t) p % usedhsize != 0) return 0;
+  }
+  return 1;
+}
+
+int map_large(){
+  // large requests get their own mapping and never touch the heap
+  umemmapthreshold(1 << 16);
+  umeminit(1 << 16, FIRST_FIT);
+  dumpandparse();
+  size_t initialsize = memlog[0].size;
+
+  char *p = umalloc(1 << 20);
+  char *q = umalloc(1 << 16);
+  if (p == NULL || q == NULL) return 0;
+  memset(p, 1, 1 << 20);
+  memset(q, 1, 1 << 16);
+  dumpandparse();
+  if (lenfreelist() != 1 || memlog[0].size != initialsize) return 0;
+
+  // smaller requests still come from the heap
+  char *r = umalloc((1 << 16) - 8);
+  if (r == NULL) return 0;
+  dumpandparse();
+  if (memlog[0].size == initialsize) return 0;
+
+  void *ptrs[] = {q, r};
+  return ufree(p) == 0 && ufreebatch(ptrs, 2) == 0;
+}
+
+int map_realloc(){
+  // large blocks grow and shrink by remapping, and move back into
+  // the heap once they are under the threshold
+  umemmapthreshold(1 << 16);
+  umeminit(1 << 16, BEST_FIT);
+  char *p = umalloc(100000);
+  for (int i = 0; i < 100000; i++) p[i] = i % 251;
+
+  p = urealloc(p, 10 << 20);
+  if (p == NULL) return 0;
+  p[(10 << 20) - 1] = 1;
+  p = urealloc(p, 200000);
+  if (p == NULL) return 0;
+  for (int i = 0; i < 100000; i++) {
+    if (p[i] != (char) (i % 251)) return 0;
+  }
+
+  p = urealloc(p, 1000);
+  if (p == NULL) return 0;
+  dumpandparse();
+  if ((char*) memlog[0].addr != p + 1000) return 0;
+  for (int i = 0; i < 1000; i++) {
+    if (p[i] != (char) (i % 251)) return 0;
+  }
+
+  // a fresh mapping needs no clearing
+  char *z = ucalloc(1, 1 << 20);
+  if (z == NULL || countresident(z, 1 << 20) > 1) return 0;
+  return ufree(z) == 0 && ufree(p) == 0;
+}
+
+int map_reset(){
+  // a reset unmaps the blocks that have mappings of their own, including
+  // ones that were remapped, and leaves alone the ones already freed
+  umemmapthreshold(1 << 16);
+  umeminit(1 << 16, FIRST_FIT | THREAD_SAFE);
+  for (int round = 0; round < 50; round++) {
+    char *ptrs[4];
+    for (int i = 0; i < 4; i++) {
+      ptrs[i] = umalloc(1 << 20);
+      if (ptrs[i] == NULL) return 0;
+    }
+    if (ufree(ptrs[1]) != 0) return 0;
+    ptrs[2] = urealloc(ptrs[2], 4 << 20);
+    if (ptrs[2] == NULL) return 0;
+    if (umemreset() != 0) return 0;
+    for (int i = 0; i < 4; i++) {
+      if (ismappedaddr(ptrs[i])) return 0;
+    }
+  }
+  return 1;
+}
+
+int ishugealigned(header *block){
+  // the chunk starts on a huge page, and its blocks and the trailing
+  // fence fill out its last huge page
+  size_t huge = 2 << 20;
+  size_t start = (size_t) block->addr;
+  size_t end = start + hsize + block->size + fsize + usedhsize;
+  return start % huge < (size_t) getpagesize() && end % huge == 0;
+}
+
+int huge_region(){
+  // the region is aligned to huge pages and uses all of them
+  if (umemhugepages(3) != -1) return 0;
+  umemhugepages(HUGE_THP);
+  umeminit(3 << 20, FIRST_FIT);
+  dumpandparse();
+  if (!ishugealigned(&memlog[0])) return 0;
+  if (memlog[0].size < (3 << 20)) return 0;
+
+  char *p = umalloc(3 << 20);
+  if (p == NULL) return 0;
+  memset(p, 1, 3 << 20);
+  return ufree(p) == 0;
+}
+
+int huge_grow(){
+  // chunks mapped as the heap grows are aligned too, and asking for
+  // hugetlbfs pages falls back when there are none
+  umemhugepages(HUGE_TLB);
+  umemgrowth(GROW_FIXED, 0);
+  umeminit(1, BEST_FIT);
+  void *ptrs[3];
+  for (int i = 0; i < 3; i++) {
+    ptrs[i] = umalloc(1 << 20);
+    if (ptrs[i] == NULL) return 0;
+    memset(ptrs[i], 1, 1 << 20);
+  }
+  for (int i = 0; i < 3; i++) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  dumpandparse();
+  if (lenfreelist() < 2) return 0;
+  for (int i = 0; i < lenfreelist(); i++) {
+    if (!ishugealigned(&memlog[i])) return 0;
+  }
+  return 1;
+}
+
+int huge_buddy(){
+  // BUDDY chunks on huge pages keep the size their blocks were aligned
+  // for, so every buddy found by address is a block and merges back
+  umemhugepages(HUGE_THP);
+  umeminit(1 << 17, BUDDY);
+  dumpandparse();
+  void *first = memlog[0].addr;
+  size_t initialsize = memlog[0].size;
+
+  void *ptrs[64];
+  for (int i = 0; i < 64; i++) {
+    ptrs[i] = umalloc(8 + 24 * i);
+    if (ptrs[i] == NULL) return 0;
+  }
+  for (int i = 0; i < 64; i++) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+
+  dumpandparse();
+  for (int i = 0; i < lenfreelist(); i++) {
+    if (memlog[i].addr == first) return memlog[i].size == initialsize;
+  }
+  return 0;
+}
+
+int stats_workload(int algo){
+  // random allocations, frees and resizes keep the counters in step
+  umeminit(1 << 16, algo);
+  int nptrs = 40;
+  char *ptrs[40] = {NULL};
+  for (int i = 0; i < 2000; i++) {
+    int idx = rand() % nptrs;
+    int op = rand() % 4;
+    if (ptrs[idx] != NULL && op == 0) {
+      ptrs[idx] = urealloc(ptrs[idx], 1 + rand() % 2000);
+    }
+    else if (ptrs[idx] != NULL) {
+      if (ufree(ptrs[idx]) != 0) return 0;
+      ptrs[idx] = NULL;
+    }
+    else if (op == 1) {
+      ptrs[idx] = umemalign(64, 1 + rand() % 1000);
+    }
+    else {
+      ptrs[idx] = umalloc(1 + rand() % 2000);
+    }
+    if (i % 50 == 0 && !checkstats()) return 0;
+  }
+  for (int i = 0; i < nptrs; i++) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  return checkstats();
+}
+
+int stats_first_fit(){
+  return stats_workload(FIRST_FIT);
+}
+
+int stats_best_fit(){
+  return stats_workload(BEST_FIT);
+}
+
+int stats_buddy(){
+  return stats_workload(BUDDY);
+}
+
+int stats_calls(){
+  // calls, splits and coalesces are counted, and a heap in one piece
+  // is not fragmented
+  umeminit(1 << 16, LIFO_FIT);
+  umeminfo info = umemstats();
+  if (info.freeblocks != 1 || info.fragmentation >= 0.5) return 0;
+
+  void *ptrs[10];
+  for (int i = 0; i < 10; i++) {
+    ptrs[i] = umalloc(100);
+  }
+  if (umallocbatch(100, 10, ptrs) != 10) return 0;
+  for (int i = 0; i < 10; i += 2) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  if (ufree(ptrs[0]) != -1) return 0;
+
+  info = umemstats();
+  if (info.allocs != 20 || info.frees != 5) return 0;
+  if (info.splits < 11 || info.coalesces != 0) return 0;
+  if (info.freeblocks != 6 || info.fragmentation <= 0) return 0;
+  return info.largestfree <= info.free && checkstats();
+}
+
+int stats_largest(){
+  // a heap that is one free block is not fragmented, whatever its size
+  umeminit(12000, FIRST_FIT);
+  umeminfo info = umemstats();
+  if (info.largestfree != info.free || info.fragmentation != 0) return 0;
+  void *p = umalloc(3000);
+  umalloc(100);
+  if (ufree(p) != 0) return 0;
+  info = umemstats();
+  return info.largestfree < info.free && checkstats();
+}
+
+typedef struct {
+  umemblock last;
+  int blocks;
+  int free;
+} walkstate;
+
+int checkblock(const umemblock *block, void *ctx){
+  walkstate *w = ctx;
+  if ((char*) block->ptr - (char*) block->addr != (block->free ? hsize : usedhsize)) return -1;
+  // blocks within a chunk follow each other with no gaps, and only
+  // free blocks end in a footer
+  size_t footer = w->last.free ? fsize : 0;
+  if (w->blocks > 0 && (char*) w->last.ptr + w->last.size + footer != (char*) block->addr) return -1;
+  w->last = *block;
+  w->blocks++;
+  w->free += block->free;
+  return 0;
+}
+
+int walk_order(){
+  umeminit(8192, FIRST_FIT);
+  void *ptrs[10];
+  for (int i = 0; i < 10; i++) {
+    ptrs[i] = umalloc(100 + 8 * i);
+  }
+  for (int i = 1; i < 10; i += 3) {
+    ufree(ptrs[i]);
+  }
+
+  walkstate w = {0};
+  if (umemwalk(checkblock, &w) != 0) return 0;
+  umeminfo info = umemstats();
+  if (w.free != (int) info.freeblocks || w.blocks != 7 + w.free) return 0;
+  return umemwalk(NULL, NULL) == -1;
+}
+
+int stopwalk(const umemblock *block, void *ctx){
+  int *n = ctx;
+  return ++(*n) == 3 ? 42 : 0;
+}
+
+int walk_stop(){
+  umeminit(4096, BEST_FIT);
+  for (int i = 0; i < 5; i++) {
+    umalloc(64);
+  }
+  int n = 0;
+  if (umemwalk(stopwalk, &n) != 42) return 0;
+  return n == 3;
+}
+
+int dump_binary(){
+  umeminit(8192, SEGREGATED);
+  void *ptrs[8];
+  for (int i = 0; i < 8; i++) {
+    ptrs[i] = umalloc(200);
+  }
+  ufree(ptrs[2]);
+  ufree(ptrs[5]);
+
+  size_t len = umemdumpbin(NULL, 0);
+  if (len == 0 || len % sizeof(umemrecord) != 0) return 0;
+  size_t n = len / sizeof(umemrecord);
+  umemrecord records[64];
+  if (n > 64) return 0;
+
+  // a short buffer is filled as far as it goes and still reports the full size
+  memset(records, 0xff, sizeof(records));
+  if (umemdumpbin(records, sizeof(umemrecord)) != len) return 0;
+  if (records[1].flags != 0xffffffff) return 0;
+
+  if (umemdumpbin(records, sizeof(records)) != len) return 0;
+  int nfree = dumpandparse();
+  int seen = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (records[i].arena != 0) return 0;
+    if (i > 0 && records[i].addr <= records[i-1].addr) return 0;
+    if (records[i].flags & UMEM_RECORD_FREE) {
+      if (records[i].addr != (uint64_t) (uintptr_t) memlog[seen].addr) return 0;
+      if (records[i].size != memlog[seen].size) return 0;
+      seen++;
+    }
+    // freed blocks keep the header the used block had
+    if (i < 8 && (char*) (uintptr_t) records[i].addr + usedhsize != ptrs[i]) return 0;
+  }
+  return seen == nfree && nfree == 3 && n == 9;
+}
+
+int dump_text(){
+  umeminit(8192, BEST_FIT);
+  void *ptrs[6];
+  for (int i = 0; i < 6; i++) {
+    ptrs[i] = umalloc(300);
+  }
+  ufree(ptrs[1]);
+  ufree(ptrs[3]);
+
+  header walked[8];
+  int n = dumpandparse();
+  if (n != 3) return 0;
+  memcpy(walked, memlog, sizeof(walked));
+  if (parsedump() != n) return 0;
+  for (int i = 0; i < n; i++) {
+    if (memlog[i].addr != walked[i].addr || memlog[i].size != walked[i].size) return 0;
+    if (memlog[i].num != i || !memlog[i].free) return 0;
+  }
+  return 1;
+}
+
+int profile_percentile(){
+  umemhist hist = {0};
+  if (umempercentile(&hist, 0.5) != 0) return 0;
+  hist.buckets[3] = 90;
+  hist.buckets[10] = 9;
+  hist.buckets[20] = 1;
+  hist.count = 100;
+  if (umempercentile(&hist, 0) != 15) return 0;
+  if (umempercentile(&hist, 0.5) != 15) return 0;
+  if (umempercentile(&hist, 0.9) != 15) return 0;
+  if (umempercentile(&hist, 0.99) != 2047) return 0;
+  if (umempercentile(&hist, 0.999) != (1 << 21) - 1) return 0;
+  return umempercentile(&hist, 2) == (1 << 21) - 1;
+}
+
+int profile_calls(){
+  umeminit(1 << 16, BEST_FIT);
+  umemlatency lat;
+  // builds without PROFILE keep no histograms
+  if (umemprofile(&lat) != 0) return umemprofile(&lat) == -1;
+
+  umemprofilereset();
+  void *ptrs[100];
+  for (int i = 0; i < 100; i++) {
+    ptrs[i] = umalloc(16 + i);
+  }
+  void *p = urealloc(ptrs[0], 4000);
+  for (int i = 1; i < 100; i++) {
+    ufree(ptrs[i]);
+  }
+  ufree(p);
+
+  if (umemprofile(&lat) != 0) return 0;
+  if (lat.alloc.count != 100 || lat.free.count != 100) return 0;
+  umemhist *hists[] = {&lat.alloc, &lat.free, &lat.walk};
+  for (int i = 0; i < 3; i++) {
+    uint64_t n = 0;
+    for (int k = 0; k < 64; k++) n += hists[i]->buckets[k];
+    if (n != hists[i]->count) return 0;
+  }
+  return umempercentile(&lat.alloc, 0.99) >= umempercentile(&lat.alloc, 0.5);
+}
+
+int profile_walk(){
+  umeminit(1 << 16, FIRST_FIT);
+  umemlatency lat;
+  if (umemprofile(&lat) != 0) return umemprofile(&lat) == -1;
+
+  void *ptrs[64];
+  for (int i = 0; i < 64; i++) {
+    ptrs[i] = umalloc(64);
+  }
+  for (int i = 0; i < 64; i += 2) {
+    ufree(ptrs[i]);
+  }
+
+  // none of the 32 freed blocks fit, so the search passes them all
+  // before reaching the rest of the region
+  umemprofilereset();
+  if (umalloc(1000) == NULL) return 0;
+  umemprofile(&lat);
+  if (lat.walk.count != 1 || lat.walk.buckets[5] != 1) return 0;
+  return lat.walk.sum == 33 && umempercentile(&lat.walk, 1) == 63;
+}
+
+int readtrace(FILE *f, umemtracerec *recs, int max){
+  fflush(f);
+  rewind(f);
+  int n = fread(recs, sizeof(umemtracerec), max, f);
+  fclose(f);
+  return n;
+}
+
+int trace_record(){
+  umeminit(1 << 16, FIRST_FIT);
+  void *before = umalloc(10);
+  FILE *f = tmpfile();
+  if (umemtrace(fileno(f)) != 0) return 0;
+  if (umemtrace(fileno(f)) != -1) return 0;
+
+  void *a = umalloc(100);
+  void *b = ucalloc(4, 25);
+  a = urealloc(a, 5000);
+  ufree(b);
+  ufree(b);      // a double free is not recorded
+  ufree(before); // nor is a block from before the trace
+  void *c = umalloc(50);
+  urealloc(c, 0);
+  ufree(a);
+  if (umemtrace(-1) != 0 || umemtrace(-1) != -1) return 0;
+  umalloc(10);
+
+  umemtracerec recs[16];
+  if (readtrace(f, recs, 16) != 7) return 0;
+  int ops[] = {UMEM_TRACE_ALLOC, UMEM_TRACE_ALLOC, UMEM_TRACE_REALLOC, UMEM_TRACE_FREE,
+    UMEM_TRACE_ALLOC, UMEM_TRACE_FREE, UMEM_TRACE_FREE};
+  uint32_t ids[] = {0, 1, 0, 1, 2, 2, 0};
+  uint64_t sizes[] = {100, 100, 5000, 0, 50, 0, 0};
+  for (int i = 0; i < 7; i++) {
+    if (recs[i].op != ops[i] || recs[i].id != ids[i] || recs[i].size != sizes[i]) return 0;
+    if (recs[i].thread != recs[0].thread || recs[i].thread == 0) return 0;
+    if (i > 0 && recs[i].time < recs[i-1].time) return 0;
+  }
+  return 1;
+}
+
+void *trace_worker(void *arg){
+  void *ptrs[50];
+  for (int i = 0; i < 50; i++) {
+    ptrs[i] = umalloc(16 + i);
+  }
+  for (int i = 0; i < 50; i++) {
+    ufree(ptrs[i]);
+  }
+  if (umallocbatch(300, 50, ptrs) != 50) return NULL;
+  return ufreebatch(ptrs, 50) == 0 ? arg : NULL;
+}
+
+int trace_threads(){
+  umeminit(1 << 20, BEST_FIT | THREAD_SAFE);
+  FILE *f = tmpfile();
+  if (umemtrace(fileno(f)) != 0) return 0;
+  pthread_t threads[4];
+  for (long i = 0; i < 4; i++) {
+    pthread_create(&threads[i], NULL, trace_worker, (void*) (i + 1));
+  }
+  int rc = 1;
+  for (int i = 0; i < 4; i++) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    if (ret == NULL) rc = 0;
+  }
+  if (umemtrace(-1) != 0) return 0;
+
+  // every block is handed out once and freed once, by the same thread
+  static umemtracerec recs[1000];
+  if (readtrace(f, recs, 1000) != 800) return 0;
+  int allocs[400] = {0};
+  int frees[400] = {0};
+  uint16_t owner[400];
+  for (int i = 0; i < 800; i++) {
+    if (recs[i].id >= 400) return 0;
+    if (recs[i].op == UMEM_TRACE_ALLOC) {
+      allocs[recs[i].id]++;
+      owner[recs[i].id] = recs[i].thread;
+    }
+    else if (recs[i].op == UMEM_TRACE_FREE) {
+      if (allocs[recs[i].id] != 1 || owner[recs[i].id] != recs[i].thread) return 0;
+      frees[recs[i].id]++;
+    }
+    else return 0;
+  }
+  for (int i = 0; i < 400; i++) {
+    if (allocs[i] != 1 || frees[i] != 1) return 0;
+  }
+  return rc;
+}
+
+int usable_size(){
+  umeminit(4096, BEST_FIT | SLAB);
+  umemmapthreshold(1 << 16);
+  char *small = umalloc(20);
+  char *block = umalloc(100);
+  char *odd = umalloc(101);
+  char *large = umalloc(1 << 17);
+  if (umemusablesize(small) != 24) return 0;
+  if (umemusablesize(block) != 104 || umemusablesize(odd) != 104) return 0;
+  if (umemusablesize(large) < 1 << 17) return 0;
+  ufree(block);
+  if (umemusablesize(block) != 0) return 0;
+  return umemusablesize(NULL) == 0;
+}
+
+int min_align(){
+  // with a minimum alignment of 16 every kind of block is aligned to it
+  if (umemminalign(24) != -1 || umemminalign(32) != -1) return 0;
+  if (umemminalign(16) != 0) return 0;
+  umemmapthreshold(1 << 16);
+  umeminit(1 << 16, FIRST_FIT | SLAB);
+  if (umemminalign(8) != -1) return 0;
+  for (size_t size = 1; size < 300; size++) {
+    char *p = umalloc(size);
+    char *q = ucalloc(1, size);
+    char *r = umemalign(16, size);
+    if ((size_t) p % 16 != 0 || (size_t) q % 16 != 0 || (size_t) r % 16 != 0) return 0;
+    p = urealloc(p, size * 3);
+    if ((size_t) p % 16 != 0) return 0;
+  }
+  char *large = umalloc(1 << 17);
+  return large != NULL && (size_t) large % 16 == 0;
+}
+
+int min_align_buddy(){
+  // BUDDY can only align to its used header
+  umemminalign(16);
+  return umeminit(4096, BUDDY) == (usedhsize >= 16 ? 0 : -1);
+}
+
+int used_no_footer(){
+  // a used block ends where its data does, so the next header follows it
+  umeminit(4096, FIRST_FIT);
+  char *a = umalloc(100);
+  char *b = umalloc(100);
+  if (b != a + umemusablesize(a) + usedhsize) return 0;
+  memset(a, 'a', umemusablesize(a));
+  memset(b, 'b', umemusablesize(b));
+  if (ufree(a) != 0) return 0;
+
+  // freeing a gives it a footer again without reaching into b
+  for (size_t i = 0; i < umemusablesize(b); i++) {
+    if (b[i] != 'b') return 0;
+  }
+  walkstate w = {0};
+  return umemwalk(checkblock, &w) == 0 && w.free == 2;
+}
+
+int coalesce_prev_free(){
+  // the header after a free block says so, which is how a freed
+  // block finds the free block before it to join with
+  umeminit(4096, LIFO_FIT);
+  char *ptrs[4];
+  for (int i = 0; i < 4; i++) {
+    ptrs[i] = umalloc(100);
+  }
+  if (ufree(ptrs[0]) != 0 || ufree(ptrs[2]) != 0) return 0;
+  if (ufree(ptrs[1]) != 0) return 0;
+  dumpandparse();
+  if (lenfreelist() != 2) return 0;
+  for (int i = 0; i < 2; i++) {
+    if (memlog[i].addr == ptrs[0] - usedhsize) {
+      return memlog[i].size == 3 * (104 + usedhfsize) - hfsize;
+    }
+  }
+  return 0;
+}
+
+int free_ascending(int algo){
+  // freeing every other block in address order finds each one's place
+  // on the free list next to the block freed before it, rather than by
+  // walking the used blocks after it, so the frees take linear time
+  static char *ptrs[20000];
+  int n = 20000;
+  umeminit(1 << 22, algo);
+  for (int i = 0; i < n; i++) {
+    ptrs[i] = umalloc(24);
+    if (ptrs[i] == NULL || umalloc(40) == NULL) return 0;
+  }
+  clock_t start = clock();
+  for (int i = 0; i < n; i++) {
+    if (ufree(ptrs[i]) != 0) return 0;
+  }
+  if (clock() - start > CLOCKS_PER_SEC / 4) return 0;
+  if (umemstats().freeblocks != (size_t) n + 1) return 0;
+
+  // the list is in address order, so first fit hands them back in turn
+  if (algo != FIRST_FIT) return 1;
+  for (int i = 0; i < n; i++) {
+    if (umalloc(24) != ptrs[i]) return 0;
+  }
+  return 1;
+}
+
+int free_ascending_first_fit(){
+  return free_ascending(FIRST_FIT);
+}
+
+int free_ascending_next_fit(){
+  return free_ascending(NEXT_FIT);
+}
+
+int free_ascending_worst_fit(){
+  return free_ascending(WORST_FIT);
+}
+
 int stress_test_first_fit(){
   umeminit(10000, FIRST_FIT);
   return stress_test(1000);
@@ -492,13 +1987,12 @@ int stress_test_first_fit(){
 
 int stress_test_best_fit(){
   umeminit(10000, BEST_FIT);
-  return stress_test(10);
+  return stress_test(1000);
 }
 
 int stress_test_worst_fit(){
   umeminit(10000, WORST_FIT);
-  // return stress_test(5);
-  return 1;
+  return stress_test(1000);
 }
 
 int stress_test_next_fit(){
@@ -540,7 +2034,74 @@ int main(int nargs, char **args){
     stress_test_first_fit,    // 21
     stress_test_best_fit,     // 22
     stress_test_worst_fit,    // 23
-    stress_test_next_fit      // 24
+    stress_test_next_fit,     // 24
+    buddy_split_merge,        // 25
+    buddy_power_of_two,       // 26
+    segregated_reuse,         // 27
+    stress_test_segregated,   // 28
+    best_fit_many,            // 29
+    lifo_fit,                 // 30
+    stress_test_lifo_fit,     // 31
+    grow_fixed,               // 32
+    grow_limit,               // 33
+    grow_buddy,               // 34
+    trim_explicit,            // 35
+    trim_threshold,           // 36
+    thread_cache,             // 37
+    threads_concurrent,       // 38
+    arenas_separate,          // 39
+    threads_arenas,           // 40
+    heaps_separate,           // 41
+    heaps_destroy,            // 42
+    heaps_invalid,            // 43
+    reset_heap,               // 44
+    reset_bump,               // 45
+    reset_threads,            // 46
+    reset_created,            // 47
+    realloc_shrink,           // 48
+    realloc_grow,             // 49
+    realloc_move,             // 50
+    calloc_fresh,             // 51
+    calloc_trim,              // 52
+    calloc_small,             // 53
+    align_sizes,              // 54
+    align_slack,              // 55
+    align_invalid,            // 56
+    batch_alloc,              // 57
+    batch_free,               // 58
+    batch_invalid,            // 59
+    slab_small,               // 60
+    slab_fallthrough,         // 61
+    slab_threads,             // 62
+    align_buddy_slab,         // 63
+    map_large,                // 64
+    map_realloc,              // 65
+    map_reset,                // 66
+    huge_region,              // 67
+    huge_grow,                // 68
+    huge_buddy,               // 69
+    stats_first_fit,          // 70
+    stats_best_fit,           // 71
+    stats_buddy,              // 72
+    stats_calls,              // 73
+    stats_largest,            // 74
+    walk_order,               // 75
+    walk_stop,                // 76
+    dump_binary,              // 77
+    dump_text,                // 78
+    profile_percentile,       // 79
+    profile_calls,            // 80
+    profile_walk,             // 81
+    trace_record,             // 82
+    trace_threads,            // 83
+    usable_size,              // 84
+    min_align,                // 85
+    min_align_buddy,          // 86
+    used_no_footer,           // 87
+    coalesce_prev_free,       // 88
+    free_ascending_first_fit, // 89
+    free_ascending_next_fit,  // 90
+    free_ascending_worst_fit  // 91
   };
 
   if (strcmp(args[1], "-n") == 0){
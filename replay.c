@@ -0,0 +1,189 @@
+#include "umem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define REGION (16 << 20)  // initial umem region, grown by doubling past that
+#define NSAMPLES (10)      // points the fragmentation is reported at
+
+typedef struct {
+  const char *name;
+  int algo;
+} policy;
+
+policy POLICIES[] = {
+  {"first", FIRST_FIT},
+  {"best", BEST_FIT},
+  {"worst", WORST_FIT},
+  {"next", NEXT_FIT},
+  {"buddy", BUDDY},
+  {"segregated", SEGREGATED},
+  {"lifo", LIFO_FIT},
+};
+#define NPOLICIES (sizeof(POLICIES) / sizeof(policy))
+
+umemtracerec *RECS;
+size_t NRECS;
+uint32_t NIDS;             // one more than the largest block id in the trace
+
+// TRACE FUNCTIONS
+
+int loadtrace(char *path){
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror("fopen");
+    return -1;
+  }
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  rewind(f);
+  if (len < 0 || len % sizeof(umemtracerec) != 0) {
+    fprintf(stderr, "%s is not a umem trace\n", path);
+    fclose(f);
+    return -1;
+  }
+
+  NRECS = len / sizeof(umemtracerec);
+  RECS = malloc(len + 1);
+  if (RECS == NULL || fread(RECS, sizeof(umemtracerec), NRECS, f) != NRECS) {
+    fprintf(stderr, "could not read %s\n", path);
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  for (size_t i = 0; i < NRECS; i++) {
+    if (RECS[i].op < UMEM_TRACE_ALLOC || RECS[i].op > UMEM_TRACE_REALLOC) {
+      fprintf(stderr, "record %zu has an unknown op %d\n", i, RECS[i].op);
+      return -1;
+    }
+    if (RECS[i].id >= NIDS) NIDS = RECS[i].id + 1;
+  }
+  return 0;
+}
+
+uint64_t now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// DRIVER FUNCTIONS
+
+/*
+  calls are replayed in the order they were recorded, all from one
+  thread and as fast as they will go. The heap is sampled at evenly
+  spaced points, and the time spent sampling is left out
+*/
+void replay(policy *p){
+  umemgrowth(GROW_DOUBLE, 0);
+  if (umeminit(REGION, p->algo) != 0) {
+    fprintf(stderr, "umeminit failed for %s\n", p->name);
+    exit(1);
+  }
+  void **ptrs = calloc(NIDS, sizeof(void*));
+  if (ptrs == NULL) {
+    fprintf(stderr, "out of memory for %u blocks\n", NIDS);
+    exit(1);
+  }
+
+  size_t failed = 0;
+  size_t peakheap = 0;
+  size_t peakinuse = 0;
+  double frag[NSAMPLES] = {0};
+  int sample = 0;
+  uint64_t elapsed = 0;
+  uint64_t start = now();
+  for (size_t i = 0; i < NRECS; i++) {
+    umemtracerec *r = &RECS[i];
+    void *ptr;
+    switch (r->op) {
+    case UMEM_TRACE_ALLOC:
+      ptr = umalloc(r->size);
+      if (ptr == NULL) failed++;
+      else *(char*) ptr = 1;
+      ptrs[r->id] = ptr;
+      break;
+    case UMEM_TRACE_REALLOC:
+      ptr = urealloc(ptrs[r->id], r->size);
+      if (ptr == NULL) failed++;
+      else ptrs[r->id] = ptr;
+      break;
+    case UMEM_TRACE_FREE:
+      ufree(ptrs[r->id]);
+      ptrs[r->id] = NULL;
+      break;
+    }
+
+    if (sample < NSAMPLES && (i + 1) * NSAMPLES >= NRECS * (sample + 1)) {
+      elapsed += now() - start;
+      umeminfo info = umemstats();
+      if (info.heapsize > peakheap) peakheap = info.heapsize;
+      if (info.inuse > peakinuse) peakinuse = info.inuse;
+      frag[sample++] = info.fragmentation;
+      start = now();
+    }
+  }
+  elapsed += now() - start;
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("%-10s %10.3f %12zu %12zu %10ld %7zu ", p->name, elapsed / 1e6,
+    peakheap >> 10, peakinuse >> 10, usage.ru_maxrss, failed);
+  for (int k = 0; k < NSAMPLES; k++) printf(" %5.3f", frag[k]);
+  printf("\n");
+  fflush(stdout);
+}
+
+/*
+  umeminit can only be called once per process, so each policy replays
+  the trace in a child of its own
+*/
+int runone(policy *p){
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0) {
+    replay(p);
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]){
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s trace [policy|all]\n", argv[0]);
+    fprintf(stderr, "policies:");
+    for (size_t i = 0; i < NPOLICIES; i++) fprintf(stderr, " %s", POLICIES[i].name);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+  if (loadtrace(argv[1]) != 0) return 1;
+  char *policyarg = argc > 2 ? argv[2] : "all";
+
+  printf("# %zu calls on %u blocks, peaks in kb, fragmentation at each tenth of the trace\n", NRECS, NIDS);
+  printf("%-10s %10s %12s %12s %10s %7s  %s\n",
+    "policy", "time_ms", "peak_heap", "peak_inuse", "maxrss_kb", "failed", "frag");
+  fflush(stdout);
+  int runs = 0;
+  int failed = 0;
+  for (size_t i = 0; i < NPOLICIES; i++) {
+    if (strcmp(policyarg, "all") != 0 && strcmp(policyarg, POLICIES[i].name) != 0) continue;
+    runs++;
+    if (runone(&POLICIES[i]) != 0) failed++;
+  }
+  if (runs == 0) {
+    fprintf(stderr, "unknown policy %s\n", policyarg);
+    return 1;
+  }
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+#include "umem.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+/*
+  shim.c puts umem behind malloc and friends so that it can be loaded
+  into unmodified programs with LD_PRELOAD. Build it with everything
+  but the exported calls hidden, so that umem's own functions can never
+  be bound to a program's functions of the same name:
+
+    gcc -O2 -shared -fPIC -fvisibility=hidden -ftls-model=initial-exec \
+      -pthread shim.c umem.c -o libumem.so
+
+  The heap is set up on the first call, from these variables:
+  - UMEM_ALGO: first, best, worst, next, buddy, segregated or lifo (best)
+  - UMEM_REGION: bytes mapped up front (64MB), grown by doubling past that
+
+  Every pointer is 16 byte aligned, as malloc promises for max_align_t.
+  BUDDY aligns its headers rather than its data, so should umeminit
+  refuse it that alignment UMEM_ALGO=buddy falls back to best.
+
+  The arenas are locked around fork, so that a child forked while
+  another thread is in a call does not find a lock that is never let go
+*/
+
+#define EXPORT __attribute__((visibility("default")))
+#define REGION ((size_t) 64 << 20)
+#define MAPTHRESHOLD ((size_t) 128 << 10) // requests this large get their own mapping, like glibc
+#define BOOTSIZE (64 << 10)               // memory for calls made while the heap is set up
+#define ALIGNMENT (16)                    // alignment of max_align_t
+
+#define UNINIT (0)
+#define INITIALIZING (1)
+#define READY (2)
+
+int STATE = UNINIT;
+__thread bool INITTHREAD = false;   // the thread running umeminit
+char BOOT[BOOTSIZE] __attribute__((aligned(64)));
+size_t BOOTUSED = 0;
+
+// BOOTSTRAP FUNCTIONS
+
+/*
+  anything umeminit itself allocates comes from BOOT, and is never freed
+*/
+void *bootalloc(size_t alignment, size_t size){
+  size_t start = (BOOTUSED + alignment - 1) & ~(alignment - 1);
+  if (start + size > BOOTSIZE) return NULL;
+  BOOTUSED = start + size;
+  return BOOT + start;
+}
+
+bool isboot(void *ptr){
+  return (char*) ptr >= BOOT && (char*) ptr < BOOT + BOOTSIZE;
+}
+
+int getalgo(){
+  char *name = getenv("UMEM_ALGO");
+  if (name == NULL) return BEST_FIT;
+  const char *names[] = {"best", "worst", "first", "next", "buddy", "segregated", "lifo"};
+  int algos[] = {BEST_FIT, WORST_FIT, FIRST_FIT, NEXT_FIT, BUDDY, SEGREGATED, LIFO_FIT};
+  for (int i = 0; i < 7; i++) {
+    if (strcmp(name, names[i]) == 0) return algos[i];
+  }
+  return BEST_FIT;
+}
+
+/*
+  the first thread to get here sets up the heap, any others wait for it.
+  returns false while the calling thread is the one setting it up, so
+  that its calls go to BOOT instead
+*/
+bool ready(){
+  if (__atomic_load_n(&STATE, __ATOMIC_ACQUIRE) == READY) return true;
+  if (INITTHREAD) return false;
+
+  int expected = UNINIT;
+  if (__atomic_compare_exchange_n(&STATE, &expected, INITIALIZING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    INITTHREAD = true;
+    char *region = getenv("UMEM_REGION");
+    size_t size = region != NULL ? strtoull(region, NULL, 0) : 0;
+    size = size != 0 ? size : REGION;
+    umemgrowth(GROW_DOUBLE, 0);
+    umemmapthreshold(MAPTHRESHOLD);
+    umemminalign(ALIGNMENT);
+    if (umeminit(size, getalgo() | THREAD_SAFE) != 0) umeminit(size, BEST_FIT | THREAD_SAFE);
+    pthread_atfork(umemlockall, umemunlockall, umemunlockall);
+    INITTHREAD = false;
+    __atomic_store_n(&STATE, READY, __ATOMIC_RELEASE);
+    return true;
+  }
+  while (__atomic_load_n(&STATE, __ATOMIC_ACQUIRE) != READY) sched_yield();
+  return true;
+}
+
+// EXPORTED FUNCTIONS
+
+EXPORT void *malloc(size_t size){
+  if (!ready()) return bootalloc(ALIGNMENT, size);
+  void *ptr = umalloc(size == 0 ? 1 : size);
+  if (ptr == NULL) errno = ENOMEM;
+  return ptr;
+}
+
+EXPORT void free(void *ptr){
+  if (ptr == NULL || isboot(ptr)) return;
+  ufree(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size){
+  size_t total;
+  if (__builtin_mul_overflow(nmemb, size, &total)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  // BOOT is zero until it is handed out
+  if (!ready()) return bootalloc(ALIGNMENT, total);
+  void *ptr = total == 0 ? umalloc(1) : ucalloc(nmemb, size);
+  if (ptr == NULL) errno = ENOMEM;
+  return ptr;
+}
+
+EXPORT void *realloc(void *ptr, size_t size){
+  if (ptr == NULL) return malloc(size);
+  if (isboot(ptr)) {
+    // the size of a BOOT block is not kept, so copy what could be there
+    void *newptr = malloc(size);
+    if (newptr == NULL) return NULL;
+    size_t avail = BOOT + BOOTSIZE - (char*) ptr;
+    memcpy(newptr, ptr, size < avail ? size : avail);
+    return newptr;
+  }
+  if (!ready()) return NULL;
+  void *newptr = urealloc(ptr, size);
+  if (newptr == NULL && size != 0) errno = ENOMEM;
+  return newptr;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size){
+  if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) return EINVAL;
+  void *ptr = ready() ? umemalign(alignment, size == 0 ? 1 : size) : bootalloc(alignment, size);
+  if (ptr == NULL) return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size){
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  void *ptr = ready() ? umemalign(alignment, size == 0 ? 1 : size) : bootalloc(alignment, size);
+  if (ptr == NULL) errno = ENOMEM;
+  return ptr;
+}
+
+/*
+  glibc still has the older aligned calls, and a block they hand out
+  would reach free here, so they are replaced too
+*/
+EXPORT void *memalign(size_t alignment, size_t size){
+  return aligned_alloc(alignment, size);
+}
+
+EXPORT void *valloc(size_t size){
+  return aligned_alloc(getpagesize(), size);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr){
+  if (ptr == NULL || isboot(ptr)) return 0;
+  return umemusablesize(ptr);
+}
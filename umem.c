@@ -1,3 +1,10 @@
+#define _GNU_SOURCE // mremap
+#ifndef HARDENING
+#define HARDENING (1) // build with -DHARDENING=0 to drop the magic number and the asserts
+#endif
+#if !HARDENING && !defined(NDEBUG)
+#define NDEBUG
+#endif
 #include "umem.h"
 #include <assert.h>
 #include <stdio.h>
@@ -7,33 +14,228 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <bits/mman-linux.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
 
 #define LOG (false)
 #define logPrint(...) if (LOG) {fprintf(stderr, "[%*.*s]\t", 12, 12, __func__); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n");}
+#ifndef PROFILE
+#define PROFILE (false) // build with -DPROFILE=true to keep latency and walk histograms
+#endif
+#define profilestart() (PROFILE ? readclock() : 0)
+#define profileend(hist, start) if (PROFILE) {addsample(&hist, readclock() - (start));}
+#define profilestep(steps) if (PROFILE) {(steps)++;}
+#define profilewalk(steps) if (PROFILE) {addsample(&WALKHIST, steps);}
 #define MAGIC (11235813)
 #define hsize (sizeof(header))
 #define fsize (sizeof(size_t))
 #define hfsize (hsize + fsize)
 #define usedhsize (hsize - (2 * sizeof(header*)))
-#define usedhfsize (usedhsize + fsize)
-
+#define usedhfsize (usedhsize)  // used blocks have no footer
+#define NBINS ((int) (sizeof(size_t) * 8))
+#define NEXACTBINS (32) // SEGREGATED blocks under 256 bytes get one bin per multiple of 8
+#define MINORDER (6) // smallest buddy block (64 bytes) that still fits a free header and footer
+#define chunkhsize (sizeof(chunk) + usedhfsize) // chunk descriptor plus the leading fence
+#define CACHEMAX (256)    // largest block size kept in the thread caches
+#define NCACHES (CACHEMAX / 8 + 1)
+#define CACHEBATCH (16)   // blocks moved between a thread cache and the heap at once
+#define CACHELIMIT (64)   // blocks a thread cache holds per size before draining
+#define MAXARENAS (64)
+#define HUGESIZE ((size_t) 2 << 20) // chunks are aligned to huge pages of this size
+#define SLABSIZE (4096)   // every slab is one page of equal objects
+#define SLABMAX (64)      // largest object kept in slabs
+#define NSLABS (SLABMAX / 8)
+#define SLABWORDS (SLABSIZE / 8 / 64)
+#define SLABSPACE ((size_t) 1 << 26) // address space reserved for the slabs of each arena
+#define ZEROBIT (2)       // set in sf of a free block whose memory is known to be zero from getclean on
+#define MAPBIT (4)        // set in sf of a used block that has a mapping of its own
+#define PREVBIT ((size_t) 1 << 47) // set in sf when the block before is free, so its footer can be read
+#define HEAPSHIFT (48)    // without HARDENING the heap id is kept in sf from this bit up
+#define HEAPBITS (HARDENING ? 0 : ~(((size_t) 1 << HEAPSHIFT) - 1))
+#define NHEAPIDS (HARDENING ? (size_t) 1 << 32 : (size_t) 1 << (64 - HEAPSHIFT))
+#define mapskew (alignbytes(sizeof(mapping) + usedhsize, MINALIGN) - usedhsize) // bytes before the header of a mapped block
+
+// the state of the heap being worked on lives in HEAP
+#define ALGORITHM (HEAP->algorithm)
+#define BASE (HEAP->base)
+#define TOTAlSIZE (HEAP->totalsize)
+#define CHUNKSIZE (HEAP->chunksize)
+#define GROWTH (HEAP->growth)
+#define HUGEPAGES (HEAP->hugepages)
+#define MAXHEAP (HEAP->maxheap)
+#define CHUNKS (HEAP->chunks)
+#define MAPPINGS (HEAP->mappings)
+#define TRIMTHRESHOLD (HEAP->trimthreshold)
+#define MAPTHRESHOLD (HEAP->mapthreshold)
+#define FREEBYTES (HEAP->freebytes)
+#define FREEBLOCKS (HEAP->freeblocks)
+#define FREECLASSES (HEAP->freeclasses)
+#define CLASSMAP (HEAP->classmap)
+#define CLASSBYTES (HEAP->classbytes)
+#define SPLITS (HEAP->splits)
+#define COALESCES (HEAP->coalesces)
+#define THREADSAFE (HEAP->threadsafe)
+#define HEAPLOCK (HEAP->lock)
+#define ROOT (HEAP->root)
+#define CURR (HEAP->curr)
+#define HINT (HEAP->hint)
+#define TREE (HEAP->tree)
+#define BINS (HEAP->bins)
+#define BINMAP (HEAP->binmap)
+#define TOP (HEAP->top)
+#define SLABBED (HEAP->slabbed)
+#define PARTIAL (HEAP->partial)
+#define EMPTY (HEAP->empty)
+#define SLABNEXT (HEAP->slabnext)
+#define SLABEND (HEAP->slabend)
+
+#if HARDENING
 typedef struct _header {
   size_t sf;              // 8 bytes
-  size_t magic;           // 8 bytes
+  uint32_t magic;         // 4 bytes
+  uint32_t heapid;        // 4 bytes (arena that owns the block)
   struct _header *next;   // 8 bytes (only when block is free)
   struct _header *prev;   // 8 bytes (only when block is free)
 } header;                 // total: 32 bytes (multiple of 8)
+#else
+/*
+  without the magic number a used block only needs sf, so the heap id
+  moves into its top bits
+*/
+typedef struct _header {
+  size_t sf;              // 8 bytes (heap id in the bits from HEAPSHIFT up)
+  struct _header *next;   // 8 bytes (only when block is free)
+  struct _header *prev;   // 8 bytes (only when block is free)
+} header;                 // total: 24 bytes (multiple of 8)
+#endif
+
+/*
+  every mmap'd region is a chunk. Its blocks sit between two fences,
+  used blocks of size 0, so walking or coalescing never leaves the chunk:
+  [chunk][fence header][blocks ...][fence header]
+*/
+typedef struct _chunk {
+  struct _chunk *next;    // next chunk mapped for the heap
+  void *map;              // start of the mapping
+  size_t maplen;          // length of the mapping
+  size_t size;            // bytes available to blocks between the fences
+} chunk;
+
+/*
+  a block with a mapping of its own has one of these at the start of
+  the mapping, so that its heap can find it again:
+  [mapping][header][data ...]
+*/
+typedef struct _mapping {
+  struct _mapping *next;  // next block of the heap with a mapping of its own
+  struct _mapping *prev;
+} mapping;
+
+/*
+  THREAD_SAFE caches hold used blocks by size, linked through next.
+  prev points back at the owning cache to catch double frees.
+*/
+typedef struct _tcache {
+  header *lists[NCACHES];
+  int counts[NCACHES];
+  bool registered;        // the cache is drained when its thread exits
+  unsigned resets;        // RESETS when the cache was last used
+} tcache;
+
+/*
+  a slab sits at the start of its page, followed by objects of one size
+  with no headers. A set bit in freemap marks a free object
+*/
+typedef struct _slab {
+  struct _slab *next;     // next slab of the same size with objects free
+  struct _slab *prev;
+  uint32_t heapid;
+  uint32_t size;          // size of each object
+  uint32_t used;          // objects handed out
+  uint32_t count;         // objects that fit in the slab
+  uint64_t freemap[SLABWORDS];
+} slab;
 
-int ALGORITHM = FIRST_FIT;
-void *BASE;
-size_t TOTAlSIZE;
-header *ROOT = NULL;
-header *CURR = NULL;
+/*
+  an independent heap with its own chunks, free structures and lock
+*/
+typedef struct _heap {
+  uint32_t id;            // stored in the header of every block
+  int algorithm;
+  void *base;             // first block of the first chunk
+  size_t totalsize;       // bytes available to blocks across all chunks
+  size_t chunksize;       // size of the initial region, used by GROW_FIXED
+  int growth;
+  int hugepages;          // how chunks are backed by huge pages
+  size_t maxheap;         // limit on totalsize when growing, 0 for none
+  chunk *chunks;
+  mapping *mappings;      // blocks with a mapping of their own
+  size_t trimthreshold;   // free blocks at least this big are trimmed by ufree, 0 for never
+  size_t mapthreshold;    // umalloc maps requests at least this big on their own, 0 for never
+  bool threadsafe;
+  pthread_mutex_t lock;
+  header *root;
+  header *curr;
+  header *hint;           // block last put on the address ordered free list
+  header *tree;           // BEST_FIT free blocks keyed by size; next/prev hold the left/right children
+  header *bins[NBINS];    // SEGREGATED size classes or BUDDY orders
+  size_t binmap;          // bit k is set when bins[k] is non-empty
+  header *top;            // free block kept off the free structures and bumped
+                          // into until something is freed, NULL after that
+  bool slabbed;           // small requests are served from slabs
+  slab *partial[NSLABS];  // slabs with objects free, by size
+  slab *empty;            // slabs with nothing in use, for any size
+  char *slabnext;         // the unused part of the arena's slab space
+  char *slabend;
+  size_t freebytes;       // statistics kept in step with the free blocks
+  size_t freeblocks;
+  size_t freeclasses[NBINS]; // free blocks by the power of two below their size
+  size_t classmap;        // bit k is set when freeclasses[k] is non-zero
+  size_t classbytes[NBINS]; // bytes in the free blocks of each class
+  size_t splits;
+  size_t coalesces;
+  size_t allocs;          // calls counted against the arena of the calling thread
+  size_t frees;
+} heap;
+
+heap ARENAS[MAXARENAS];
+int NARENAS = 1;
+size_t MINALIGN = 8;      // every pointer handed out is a multiple of this
+int NEXTARENA = 0;        // arena handed to the next thread that needs one
+uint32_t NEXTHEAPID = 0;  // heaps from umemcreate are numbered after the arenas, wrapping at NHEAPIDS
+unsigned RESETS = 0;      // bumped by umemreset so thread caches drop stale blocks
+__thread char *FRESH;     // the block from the last allocblock is zero from here to its end, or NULL
+__thread int MYARENA = -1;
+__thread heap *HEAP = &ARENAS[0];
+char *SLABBASE = NULL;    // slab space of every arena, so slab pointers are found by address
+char *SLABLIMIT = NULL;
+pthread_key_t CACHEKEY;
+pthread_once_t CACHEONCE = PTHREAD_ONCE_INIT;
+__thread tcache TCACHE;
+umemhist ALLOCHIST;       // umalloc latency in clock ticks, kept when PROFILE is set
+umemhist FREEHIST;        // ufree latency
+umemhist WALKHIST;        // blocks looked at by each free list search
+bool TRACING = false;     // umemtrace is recording calls to TRACEFD
 
 //  UTILITY FUNCTIONS
 
 bool checkmagic(header *h){
+#if HARDENING
   return h->magic == MAGIC;
+#else
+  (void) h;
+  return true;
+#endif
+}
+
+void lockheap() {
+  if (THREADSAFE) pthread_mutex_lock(&HEAPLOCK);
+}
+
+void unlockheap() {
+  if (THREADSAFE) pthread_mutex_unlock(&HEAPLOCK);
 }
 
 /*
@@ -54,24 +256,34 @@ int cmpsize(size_t avail, size_t req){
   else return 0; // fits the request exactly (no padding needed)
 }
 
-size_t makefooter(size_t size, int free) {
-  return size >> 1 << 1 | free;
+size_t splitsize(size_t sf) {
+  return sf & ~HEAPBITS & ~PREVBIT & ~(size_t) 7;
 }
 
-size_t splitsize(size_t sf) {
-  return sf >> 1 << 1;
+size_t makefooter(size_t size, int free) {
+  return splitsize(size) | free;
 }
 
 int splitfree(size_t sf) {
-  return (int) (sf - splitsize(sf));
+  return (int) (sf & 1);
+}
+
+/*
+  sf is only written under the lock of the heap that owns the block,
+  but the owner of a used block reads it without, while a free next to
+  it can change PREVBIT. Those reads and that write are single relaxed
+  atomic accesses, which are plain loads and stores on x86-64
+*/
+size_t getsf(header *h) {
+  return __atomic_load_n(&h->sf, __ATOMIC_RELAXED);
 }
 
 size_t getsize(header *h) {
-  return splitsize(h->sf);
+  return splitsize(getsf(h));
 }
 
 int getfree(header *h) {
-  return splitfree(h->sf);
+  return splitfree(getsf(h));
 }
 
 int gethsize(header *h){
@@ -79,11 +291,12 @@ int gethsize(header *h){
 }
 
 /*
-  returns the total size in bytes including header/footer
+  returns the total size in bytes including header/footer.
+  only free blocks have a footer
 */
 size_t blocksize(header *h){
   assert(checkmagic(h));
-  return getsize(h) + gethsize(h) + fsize;
+  return getsize(h) + (getfree(h) ? hfsize : usedhfsize);
 }
 
 size_t *getfooter(header *h) {
@@ -95,41 +308,104 @@ size_t *getprevfooter(header *h) {
   return ((size_t*)h) - 1;
 }
 
+bool getprevfree(header *h) {
+  return h->sf & PREVBIT;
+}
+
+void setprevfree(header *h, bool free) {
+  size_t sf = free ? h->sf | PREVBIT : h->sf & ~PREVBIT;
+  __atomic_store_n(&h->sf, sf, __ATOMIC_RELAXED);
+}
+
+/*
+  setfooter:
+  - write the footer of a free block
+  - tell the block after h whether h is free, since a used block
+    leaves no footer to read
+  mapped blocks have nothing after them
+*/
 void setfooter(header *h) {
   assert(checkmagic(h));
-  *(getfooter(h)) = makefooter(getsize(h), getfree(h));
+  if (h->sf & MAPBIT) return;
+  if (getfree(h)) *getfooter(h) = makefooter(getsize(h), true);
+  setprevfree((header*) ((char*) h + blocksize(h)), getfree(h));
+}
+
+/*
+  writes new over the header of the block at h, which keeps the block
+  before it
+*/
+void putheader(header *h, header new) {
+  new.sf |= h->sf & PREVBIT;
+  *h = new;
+}
+
+uint32_t getheapid(header *h) {
+#if HARDENING
+  return h->heapid;
+#else
+  return getsf(h) >> HEAPSHIFT;
+#endif
 }
 
 void setsize(header *h, size_t size) {
-  h->sf = makefooter(size, splitfree(h->sf));
-  *getfooter(h) = h->sf;
+  h->sf = makefooter(size, splitfree(h->sf)) | (h->sf & (HEAPBITS | PREVBIT));
+  setfooter(h);
 }
 
 void setfree(header *h, int free) {
   int changed = getfree(h) != free;
   if (changed) {
-    int diff = free ? hsize-usedhsize : usedhsize-hsize;
-    size_t sf = makefooter(getsize(h) - diff, free);
-    h->sf = sf;
-    *getfooter(h) = sf;
+    int diff = free ? hfsize-usedhfsize : usedhfsize-hfsize;
+    h->sf = makefooter(getsize(h) - diff, free) | (h->sf & (HEAPBITS | PREVBIT));
+    setfooter(h);
   }
 }
 
-int gethsizefromfoot(size_t sf){
-  return splitfree(sf) ? hsize : usedhsize;
+size_t blocksizefromfoot(size_t sf){
+  return splitsize(sf) + (splitfree(sf) ? hfsize : usedhfsize);
 }
 
-size_t blocksizefromfoot(size_t sf){
-  return splitsize(sf) + gethsizefromfoot(sf) + fsize;
+/*
+  a free block can know its memory is zero from some address up to its
+  footer, because the pages came fresh from mmap or were trimmed. The
+  address is kept in the word after prev and ZEROBIT says it is there
+*/
+char **getcleanptr(header *h) {
+  return (char**) ((char*) h + hsize);
+}
+
+char *getclean(header *h) {
+  return h->sf & ZEROBIT ? *getcleanptr(h) : NULL;
+}
+
+void setclean(header *h, char *clean) {
+  char *min = (char*) (getcleanptr(h) + 1);
+  if (clean != NULL && clean < min) clean = min;
+  if (clean == NULL || clean >= (char*) getfooter(h)) {
+    h->sf &= ~(size_t) ZEROBIT;
+    return;
+  }
+  *getcleanptr(h) = clean;
+  h->sf |= ZEROBIT;
 }
 
 header makeheader(size_t size, int free, header* next, header *prev){
+#if HARDENING
   header h = {
     .sf = makefooter(size, free),
     .magic = MAGIC,
+    .heapid = HEAP->id,
+    .next = next,
+    .prev = prev
+  };
+#else
+  header h = {
+    .sf = makefooter(size, free) | (size_t) HEAP->id << HEAPSHIFT,
     .next = next,
     .prev = prev
   };
+#endif
   return h;
 } 
 
@@ -159,12 +435,19 @@ header *getnextbyptr(header *h){
   return hnext;
 }
 
+/*
+  fences are the only used blocks without any space
+*/
+bool isfence(header *h) {
+  return getsize(h) == 0 && !getfree(h);
+}
+
 header *getnextbysize(header *h){
   assert(checkmagic(h));
   header *hnext = (header*)((char*)h + blocksize(h));
-  assert((char*)hnext <= (char*)BASE + TOTAlSIZE); // should not ever go outside the bounds
-  if ((char*)hnext == (char*) BASE + TOTAlSIZE) {
-    return NULL; // h was at the very end of the memory space
+  assert(checkmagic(hnext)); // should not ever go outside the bounds
+  if (isfence(hnext)) {
+    return NULL; // h was at the very end of its chunk
   }
   return hnext;
 }
@@ -176,17 +459,15 @@ header *getprevbyptr(header *h){
   return hprev;
 }
 
+/*
+  only a free block before h can be found, since a used one has no
+  footer. returns NULL otherwise, which includes the start of a chunk
+*/
 header *getprevbysize(header *h) {
   assert(checkmagic(h));
-  if (h == BASE) {
-    return NULL;
-  }
-  size_t prevsf = *getprevfooter(h);
-  size_t prevsize = splitsize(prevsf);
-  size_t prevfree = splitfree(prevsf);
-  prevsize = prevfree ? prevsize + hfsize : prevsize + usedhfsize;
-  header *hprev = (header*) ((char*)h - prevsize);
-  assert(checkmagic(hprev));
+  if (!getprevfree(h)) return NULL;
+  header *hprev = (header*) ((char*) h - blocksizefromfoot(*getprevfooter(h)));
+  assert(checkmagic(hprev) && getfree(hprev));
   return hprev;
 }
 
@@ -216,8 +497,8 @@ header *getroot(header *h){
   return node;
 }
 
-int alignbytes(int n, int bytes) {
-  int diff = (bytes - (n % bytes)) % bytes;
+size_t alignbytes(size_t n, size_t bytes) {
+  size_t diff = (bytes - (n % bytes)) % bytes;
   return n + diff;
 }
 
@@ -247,7 +528,41 @@ void insertbefore(header *h, header *hnext) {
   if (ROOT == hnext) ROOT = h;
 }
 
+/*
+  keeps the statistics of the free blocks in step as h joins (n = 1)
+  or leaves (n = -1) them
+*/
+void countfree(header *h, int n) {
+  size_t bsize = blocksize(h);
+  int class = NBINS - 1 - __builtin_clzl(bsize);
+  if (n > 0) {
+    FREEBYTES += bsize;
+    FREEBLOCKS++;
+    FREECLASSES[class]++;
+    CLASSBYTES[class] += bsize;
+    CLASSMAP |= (size_t) 1 << class;
+  }
+  else {
+    FREEBYTES -= bsize;
+    FREEBLOCKS--;
+    CLASSBYTES[class] -= bsize;
+    if (--FREECLASSES[class] == 0) CLASSMAP &= ~((size_t) 1 << class);
+  }
+}
+
+/*
+  addtofree:
+  - puts h on the address ordered free list
+  - a free block right before or after h gives its place at once.
+    Otherwise the blocks after h are walked in step with the list from
+    HINT, and whichever reaches a free block either side of h first
+    wins, so neither a long run of used blocks nor a long list makes
+    freeing in address order walk the heap
+*/
 void addtofree(header *h) {
+  countfree(h, 1);
+  header *node = HINT != NULL ? HINT : ROOT;
+  HINT = h;
   if (ROOT == NULL) {
     ROOT = h;
     h->next = NULL;
@@ -262,36 +577,49 @@ void addtofree(header *h) {
     return;
   }
   header *hnext = getnextbysize(h);
-  if (hnext != NULL && getfree(hnext)){
-    insertbefore(h, hnext);
-    return;
-  }
+  while (true) {
+    if (hnext != NULL) {
+      if (getfree(hnext)) {
+        insertbefore(h, hnext);
+        return;
+      }
+      hnext = getnextbysize(hnext);
+      assert(hnext == NULL || checkmagic(hnext));
+    }
 
-  while (hprev != NULL) {
-    if (getfree(hprev)) {
-      insertafter(h, hprev);
-      return;
+    // used blocks before h cannot be walked back over, so the list is
+    // walked towards h by address instead
+    if (node < h) {
+      if (getnextbyptr(node) == NULL || getnextbyptr(node) > h) {
+        insertafter(h, node);
+        return;
+      }
+      node = getnextbyptr(node);
     }
-    hprev = getprevbysize(hprev);
-    assert(hprev == NULL || checkmagic(hprev));
-  }
-  while (hnext != NULL) {
-    if (getfree(hnext)) {
-      insertbefore(h, hnext);
-      return;
+    else {
+      if (getprevbyptr(node) == NULL) {
+        insertbefore(h, node);
+        return;
+      }
+      node = getprevbyptr(node);
     }
-    hnext = getnextbysize(hnext);
-    assert(hnext == NULL || checkmagic(hnext));
   }
+}
 
-  // If we get here then something went very wrong...
-  // There is a free list with a ROOT but we are unable to find
-  // it for some reason
-  assert(false);
+/*
+  puts h at the head of the free list in O(1) for LIFO_FIT
+*/
+void pushfree(header *h) {
+  countfree(h, 1);
+  h->prev = NULL;
+  h->next = ROOT;
+  if (ROOT != NULL) ROOT->prev = h;
+  ROOT = h;
 }
 
 void removefromfree(header *h) {
   assert(checkmagic(h));
+  countfree(h, -1);
   header *hprev = getprevbyptr(h);
   header *hnext = getnextbyptr(h);
   if (hnext != NULL) {
@@ -306,6 +634,12 @@ void removefromfree(header *h) {
   if (ROOT == h) {
     ROOT = hnext;
   }
+  if (CURR == h) {
+    CURR = hnext;
+  }
+  if (HINT == h) {
+    HINT = hprev != NULL ? hprev : hnext;
+  }
 }
 
 header* coalesce(header *first, header *second) {
@@ -318,14 +652,20 @@ header* coalesce(header *first, header *second) {
 
   if (getfree(first) && getfree(second)) {
     assert(first->next == second && second->prev == first);
+    countfree(first, -1);
+    countfree(second, -1);
+    COALESCES++;
+    char *clean = getclean(second);
     header new = makeheader(
       blocksize(first) + blocksize(second) - hfsize,
       true,
       second->next,
       first->prev
     );
-    *first = new;
+    putheader(first, new);
     setfooter(first);
+    setclean(first, clean);
+    countfree(first, 1);
 
     // reconnect following block to coalesced block
     header *hnext = getnextbyptr(first);
@@ -333,197 +673,1398 @@ header* coalesce(header *first, header *second) {
 
     if (ROOT == second) ROOT = first;
     if (ALGORITHM == NEXT_FIT && CURR == second) CURR = first;
+    if (HINT == second) HINT = first;
 
   }
   return first;
 }
 
-//  MAIN FUNCTIONS
-
 /*
-  umeminit:
-  - request memory region of specified size and save addr to head
-  - create header with size (minus header size)
-  - write header to start of memory region
-  - save allocation algorithm
+  returns the smallest k such that 2^k >= n
 */
-int umeminit(size_t sizeOfRegion, int allocationAlgo){
-  // Parameter checking
-  if (sizeOfRegion == 0){
-    logPrint("Error: sizeOfRegion should be > 0.");
-    return -1;
-  }
-
-  if (ROOT != NULL){
-    logPrint("Error: umeminit called but memory has already been allocated.");
-    return -1;
-  }
-
-  // adjust sizeOfRegion to be a multiple of the page size
-  int page_size = getpagesize();
-  TOTAlSIZE = sizeOfRegion = alignbytes(sizeOfRegion + hfsize, page_size);
-
-
-  // Request memory from OS and save ptr at start of free list
-  BASE = mmap(NULL, TOTAlSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (BASE == MAP_FAILED) { perror("mmap"); exit(1); }
-  ROOT = CURR = (header*) BASE;
-  CURR = ROOT;
-
-  // Initialize free list by writing first header
-  header headblk = makeheader(
-    TOTAlSIZE - hfsize,
-    true,
-    NULL,
-    NULL
-  );
-  memcpy(ROOT, &headblk, sizeof(header));
-  *getfooter(ROOT) = TOTAlSIZE - hfsize;
-
-  // save allocation strategy
-  ALGORITHM = allocationAlgo;
+int getorder(size_t n) {
+  if (n <= 1) return 0;
+  return NBINS - __builtin_clzl(n - 1);
+}
 
-  return 0;
+/*
+  returns the largest k such that 2^k <= n
+*/
+int getfloororder(size_t n) {
+  return NBINS - 1 - __builtin_clzl(n);
 }
 
 /*
-  umalloc:
-  - find open spot in list
-  - write two new headers:
-    - one for the requested memory
-    - one for the shrunken free space
-  - count over header to return pointer to empty space
+  returns the size class of a block with total size bsize
 */
-header *getfirstfit(size_t size){
-  header *h = ROOT;
+int getbin(size_t bsize) {
+  if (bsize < NEXACTBINS * 8) return bsize / 8;
+  int bin = NEXACTBINS + getfloororder(bsize) - getfloororder(NEXACTBINS * 8);
+  return bin < NBINS ? bin : NBINS - 1;
+}
 
-  // check for free block until end of free list
-  while (h != NULL) {
+void addtobin(header *h, int bin) {
+  countfree(h, 1);
+  header *hnext = BINS[bin];
+  h->next = hnext;
+  h->prev = NULL;
+  if (hnext != NULL) hnext->prev = h;
+  BINS[bin] = h;
+  BINMAP |= (size_t) 1 << bin;
+}
 
-    // Block should have at least enough space for the requested block
-    if (getfree(h) && cmpsize(blocksize(h), size + usedhfsize) > -1){
-      return h;
-    }
+void removefrombin(header *h, int bin) {
+  assert(checkmagic(h));
+  countfree(h, -1);
+  header *hprev = getprevbyptr(h);
+  header *hnext = getnextbyptr(h);
+  if (hnext != NULL) hnext->prev = hprev;
+  if (hprev != NULL) hprev->next = hnext;
+  if (BINS[bin] == h) BINS[bin] = hnext;
+  if (BINS[bin] == NULL) BINMAP &= ~((size_t) 1 << bin);
+}
 
-    h = getnextbyptr(h);
-  }
-  return h;
+/*
+  BEST_FIT free blocks live in a treap ordered by (size, address).
+  The priority is a hash of the address so nothing extra has to be
+  stored and the tree stays balanced in expectation.
+*/
+size_t getpriority(header *h) {
+  return ((size_t) h >> 3) * 0x9E3779B97F4A7C15ul;
 }
 
-header *getnextfit(size_t size){
-  header *h = CURR;
+bool treeless(header *a, header *b) {
+  size_t asize = blocksize(a);
+  size_t bsize = blocksize(b);
+  return asize < bsize || (asize == bsize && a < b);
+}
 
-  // check for free block until end of free list
-  do  {
-    // Block should have at least enough space for the requested block
-    if (getfree(h) && cmpsize(blocksize(h), size + usedhfsize) > -1){
-      return h;
+header *treeinsert(header *root, header *h) {
+  if (root == NULL) {
+    h->next = NULL;
+    h->prev = NULL;
+    return h;
+  }
+  if (treeless(h, root)) {
+    root->next = treeinsert(root->next, h);
+    if (getpriority(root->next) > getpriority(root)) {
+      header *left = root->next;
+      root->next = left->prev;
+      left->prev = root;
+      return left;
     }
-
-    h = getnextbyptr(h);
-
-    if (h == NULL) {
-      h = ROOT;
+  }
+  else {
+    root->prev = treeinsert(root->prev, h);
+    if (getpriority(root->prev) > getpriority(root)) {
+      header *right = root->prev;
+      root->prev = right->next;
+      right->next = root;
+      return right;
     }
-  } while (h != CURR);
-
-  return h;
+  }
+  return root;
 }
 
-header *getbestfit(size_t size){
-  header *h = ROOT;
-
-  size_t smallestdiff = TOTAlSIZE;
-  header *bestfit = NULL;
-
-  // check for free block until end of free list
-  while (h != NULL) {
-    size_t diff = blocksize(h) - size + usedhfsize;
-    if (diff < smallestdiff){
-      smallestdiff = diff;
-      bestfit = h;
-    }
-    h = getnextbyptr(h);
+/*
+  joins two subtrees where every key in left is less than every key in right
+*/
+header *treejoin(header *left, header *right) {
+  if (left == NULL) return right;
+  if (right == NULL) return left;
+  if (getpriority(left) > getpriority(right)) {
+    left->prev = treejoin(left->prev, right);
+    return left;
   }
-  return bestfit;
+  right->next = treejoin(left, right->next);
+  return right;
 }
 
-header *getworstfit(size_t size){
-  header *h = ROOT;
-
-  size_t biggestdiff = 0;
-  header *worstfit = NULL;
+header *treeremove(header *root, header *h) {
+  assert(root != NULL); // h has to be in the tree
+  if (root == h) return treejoin(h->next, h->prev);
+  if (treeless(h, root)) root->next = treeremove(root->next, h);
+  else root->prev = treeremove(root->prev, h);
+  return root;
+}
 
-  // check for free block until end of free list
-  while (h != NULL) {
-    if (cmpsize(blocksize(h), size + usedhfsize) >= 0) {
-      size_t diff = blocksize(h) - (size + usedhfsize);
-      if (worstfit == NULL || diff > biggestdiff){
-        biggestdiff = diff;
-        worstfit = h;
-      }
-      h = getnextbyptr(h);
-    }
-  }
-  return worstfit;
+/*
+  free blocks of the list based algorithms are kept on the address
+  ordered list at ROOT. LIFO_FIT keeps an unordered list at ROOT and
+  the others keep them in BINS or TREE.
+*/
+bool isaddressordered() {
+  return ALGORITHM == FIRST_FIT || ALGORITHM == NEXT_FIT || ALGORITHM == WORST_FIT;
 }
 
-void *umalloc(size_t size){
-  if (BASE == NULL) {
-    return NULL;
-  }
-  if (size <= 0) {
-    return NULL;
+void linkfree(header *h) {
+  switch (ALGORITHM)
+  {
+  case SEGREGATED:
+    addtobin(h, getbin(blocksize(h)));
+    break;
+  case BEST_FIT:
+    countfree(h, 1);
+    TREE = treeinsert(TREE, h);
+    break;
+  case LIFO_FIT:
+    pushfree(h);
+    break;
+  default:
+    addtofree(h);
+    break;
   }
+}
 
-  // Minimum size is the width of the prev ptr + next ptr
-  // this way a used block can always be free'd without 
-  // changing the size of the block.
-  if (size < hsize - usedhsize) size = hsize - usedhsize;
-  // Also ensure that each pointer is aligned on 8-byte boundaries.
-  size = alignbytes(size, 8);
-  assert(size % 8 == 0);
-
-  // Get next block based on allocation algorithm
-  header *h;
+void unlinkfree(header *h) {
   switch (ALGORITHM)
   {
-  case FIRST_FIT:
-    h = getfirstfit(size);
-    break;
-  case NEXT_FIT:
-    h = getnextfit(size);
+  case SEGREGATED:
+    removefrombin(h, getbin(blocksize(h)));
     break;
   case BEST_FIT:
-    h = getbestfit(size);
+    countfree(h, -1);
+    TREE = treeremove(TREE, h);
     break;
-  case WORST_FIT:
-    h = getworstfit(size);
+  case BUDDY:
+    removefrombin(h, getorder(blocksize(h)));
     break;
   default:
+    removefromfree(h);
     break;
   }
+}
 
-  // NULL indicates there was not enough space for the request
-  if (h == NULL){
-    return NULL;
+/*
+  merges two physically adjacent free blocks that are not on any free list
+*/
+header *joinblocks(header *first, header *second) {
+  COALESCES++;
+  char *clean = getclean(second);
+  putheader(first, makeheader(blocksize(first) + blocksize(second) - hfsize, true, NULL, NULL));
+  setfooter(first);
+  setclean(first, clean);
+  return first;
+}
+
+/*
+  coalesces a free block with its neighbours using only the boundary tags,
+  then links the result into the free structure
+*/
+header *mergefree(header *h) {
+  header *hnext = getnextbysize(h);
+  if (hnext != NULL && getfree(hnext)) {
+    unlinkfree(hnext);
+    h = joinblocks(h, hnext);
   }
-  
-  // Set requested block as not free FIRST in order to 
-  // account for header size changing 
-  header *hnext = getnextbyptr(h);
-  header *hprev = getprevbyptr(h);
+  header *hprev = getprevbysize(h);
+  if (hprev != NULL && getfree(hprev)) {
+    unlinkfree(hprev);
+    h = joinblocks(hprev, h);
+  }
+  linkfree(h);
+  return h;
+}
 
-  int cmp = cmpsize(blocksize(h), size + usedhfsize);
+//  PROFILE FUNCTIONS
 
-  // Block fits the request and a new block 
-  if (cmp == 2) {
+/*
+  ticks are TSC cycles on x86 and nanoseconds elsewhere
+*/
+uint64_t readclock() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
 
-    // create new requested block header
-    header requested = makeheader(
-      size,
-      false,
-      NULL,
+/*
+  a sample v goes in bucket k when 2^k <= v < 2^(k+1), and 0 goes in
+  bucket 0. Samples come from every thread, so THREAD_SAFE heaps add
+  them atomically
+*/
+void addsample(umemhist *hist, uint64_t v) {
+  int k = v == 0 ? 0 : 63 - __builtin_clzl(v);
+  if (ARENAS[0].threadsafe) {
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, v, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->buckets[k], 1, __ATOMIC_RELAXED);
+  }
+  else {
+    hist->count++;
+    hist->sum += v;
+    hist->buckets[k]++;
+  }
+}
+
+//  SEGREGATED FUNCTIONS
+
+/*
+  getsegregatedfit:
+  - exact bins only hold blocks of the requested size
+  - power of two bins hold a range of sizes, so the request's own
+    bin is searched block by block
+  - otherwise the head of the first non-empty larger bin always fits
+*/
+header *getsegregatedfit(size_t size) {
+  size_t req = size + usedhfsize;
+  int bin = getbin(req);
+  size_t steps = 0;
+  if (bin >= NEXACTBINS) {
+    for (header *h = BINS[bin]; h != NULL; h = getnextbyptr(h)) {
+      profilestep(steps);
+      if (blocksize(h) >= req) {
+        profilewalk(steps);
+        return h;
+      }
+    }
+    bin++;
+  }
+  profilewalk(steps);
+  if (bin >= NBINS) return NULL;
+
+  size_t avail = BINMAP >> bin << bin;
+  if (avail == 0) return NULL;
+  return BINS[__builtin_ctzl(avail)];
+}
+
+
+//  BUDDY FUNCTIONS
+
+/*
+  writes a free block spanning exactly 2^order bytes at h
+*/
+void makebuddyblock(header *h, int order) {
+  putheader(h, makeheader(((size_t) 1 << order) - hfsize, true, NULL, NULL));
+  setfooter(h);
+}
+
+/*
+  buddies are found by flipping the order bit of the block's address.
+  BUDDY chunks are aligned past their largest block, so this is the same
+  as flipping it in the offset from the start of the chunk. A buddy past
+  the last block is the trailing fence, which is never free.
+*/
+header *getbuddy(header *h, int order) {
+  header *buddy = (header*) ((size_t) h ^ ((size_t) 1 << order));
+  assert(checkmagic(buddy));
+  return buddy;
+}
+
+/*
+  carves a chunk into the largest aligned power of two blocks.
+  chunk sizes are a multiple of the page size so nothing is left over.
+*/
+void initbuddy(char *p, size_t left) {
+  while (left >= (size_t) 1 << MINORDER) {
+    int order = getfloororder(left);
+    makebuddyblock((header*) p, order);
+    addtobin((header*) p, order);
+    p += (size_t) 1 << order;
+    left -= (size_t) 1 << order;
+  }
+}
+
+/*
+  getbuddyfit:
+  - find the smallest non-empty order that fits the request
+  - split it in half until it is the size of the request,
+    putting each unused upper half on its free list
+  - mark the block as used
+*/
+header *getbuddyfit(size_t size) {
+  int order = getorder(size + usedhfsize);
+  if (order < MINORDER) order = MINORDER;
+  if (order >= NBINS) return NULL;
+
+  size_t avail = BINMAP >> order << order;
+  if (avail == 0) return NULL;
+  int k = __builtin_ctzl(avail);
+
+  header *h = BINS[k];
+  removefrombin(h, k);
+  while (k > order) {
+    k--;
+    SPLITS++;
+    header *upper = (header*) ((char*) h + ((size_t) 1 << k));
+    makebuddyblock(upper, k);
+    addtobin(upper, k);
+  }
+  makebuddyblock(h, order);
+  setfree(h, false);
+  return h;
+}
+
+/*
+  buddyfree:
+  - merge the block with its buddy for as long as the buddy is free
+    and has not been split
+  - put the merged block on the free list of its order
+*/
+header *buddyfree(header *h) {
+  int order = getorder(blocksize(h));
+  header *buddy;
+  while ((buddy = getbuddy(h, order)) != NULL
+      && getfree(buddy)
+      && blocksize(buddy) == (size_t) 1 << order) {
+    removefrombin(buddy, order);
+    COALESCES++;
+    if (buddy < h) h = buddy;
+    order++;
+  }
+  makebuddyblock(h, order);
+  addtobin(h, order);
+  return h;
+}
+
+//  BUMP FUNCTIONS
+
+/*
+  until the first free a fresh heap is one block in use after another,
+  followed by TOP. Allocating just carves the next block off TOP
+*/
+
+/*
+  starts bumping from the initial region. BUDDY blocks have to stay
+  on their power of two boundaries, so that mode never bumps
+*/
+void starttop() {
+  if (ALGORITHM != BUDDY) {
+    TOP = BASE;
+    unlinkfree(TOP);
+    countfree(TOP, 1);
+  }
+  CURR = ROOT;
+}
+
+/*
+  hands TOP to the free structures, after which the heap never bumps
+  again until it is reset
+*/
+void retiretop() {
+  if (TOP == NULL) return;
+  header *h = TOP;
+  TOP = NULL;
+  countfree(h, -1);
+  linkfree(h);
+  if (CURR == NULL) CURR = ROOT;
+}
+
+/*
+  bumpalloc:
+  - split size bytes off the front of TOP, leaving the rest as TOP
+  returns NULL if that would not leave room for a free block
+*/
+header *bumpalloc(size_t size) {
+  header *h = TOP;
+  if (cmpsize(blocksize(h), size + usedhfsize) != 2) return NULL;
+
+  size_t left = blocksize(h) - size - usedhfsize;
+  FRESH = getclean(h);
+  countfree(h, -1);
+  SPLITS++;
+  putheader(h, makeheader(size, false, NULL, NULL));
+  setfooter(h);
+
+  TOP = (header*) ((char*) h + blocksize(h));
+  *TOP = makeheader(left - hfsize, true, NULL, NULL);
+  setfooter(TOP);
+  setclean(TOP, FRESH);
+  countfree(TOP, 1);
+  return h;
+}
+
+//  SLAB FUNCTIONS
+
+bool isslab(void *ptr) {
+  return (char*) ptr >= SLABBASE && (char*) ptr < SLABLIMIT;
+}
+
+slab *getslab(void *ptr) {
+  return (slab*) ((size_t) ptr / SLABSIZE * SLABSIZE);
+}
+
+void pushslab(slab **list, slab *s) {
+  s->prev = NULL;
+  s->next = *list;
+  if (*list != NULL) (*list)->prev = s;
+  *list = s;
+}
+
+void unlinkslab(slab **list, slab *s) {
+  if (s->prev != NULL) s->prev->next = s->next;
+  else *list = s->next;
+  if (s->next != NULL) s->next->prev = s->prev;
+}
+
+/*
+  newslab:
+  - reuse an empty slab or take the next page of the slab space
+  - mark all of its objects free and add it to the partial slabs
+  returns NULL once the slab space is used up
+*/
+slab *newslab(size_t size) {
+  slab *s = EMPTY;
+  if (s != NULL) {
+    EMPTY = s->next;
+  }
+  else if (SLABNEXT < SLABEND) {
+    s = (slab*) SLABNEXT;
+    SLABNEXT += SLABSIZE;
+  }
+  else {
+    return NULL;
+  }
+
+  s->heapid = HEAP->id;
+  s->size = size;
+  s->used = 0;
+  s->count = (SLABSIZE - sizeof(slab)) / size;
+  for (int i = 0; i < SLABWORDS; i++) {
+    int bits = (int) s->count - i * 64;
+    if (bits >= 64) s->freemap[i] = ~(uint64_t) 0;
+    else if (bits > 0) s->freemap[i] = ((uint64_t) 1 << bits) - 1;
+    else s->freemap[i] = 0;
+  }
+  pushslab(&PARTIAL[size / 8 - 1], s);
+  return s;
+}
+
+/*
+  slaballoc:
+  - take the first free object of a partial slab of this size
+  - a slab that fills up leaves the partial slabs
+  returns NULL if there is no slab space left
+*/
+void *slaballoc(size_t size) {
+  slab **list = &PARTIAL[size / 8 - 1];
+  slab *s = *list;
+  if (s == NULL && (s = newslab(size)) == NULL) return NULL;
+
+  int w = 0;
+  while (s->freemap[w] == 0) w++;
+  int bit = __builtin_ctzl(s->freemap[w]);
+  s->freemap[w] &= ~((uint64_t) 1 << bit);
+  if (++s->used == s->count) unlinkslab(list, s);
+  return (char*) s + sizeof(slab) + (size_t) (w * 64 + bit) * size;
+}
+
+/*
+  slabfree:
+  - set the object's bit again, in the arena that owns the slab
+  - a full slab rejoins the partial slabs, and an empty one is kept
+    for any size
+  returns -1 if ptr is not an object in use
+*/
+int slabfree(void *ptr) {
+  slab *s = getslab(ptr);
+  size_t offset = (char*) ptr - (char*) s - sizeof(slab);
+  if ((char*) ptr < (char*) s + sizeof(slab) || s->size == 0 ||
+      offset % s->size != 0 || offset / s->size >= s->count) {
+    logPrint("Invalid ptr");
+    return -1;
+  }
+
+  HEAP = &ARENAS[s->heapid];
+  lockheap();
+  size_t i = offset / s->size;
+  uint64_t mask = (uint64_t) 1 << (i % 64);
+  if (s->freemap[i / 64] & mask) {
+    unlockheap();
+    logPrint("Double free");
+    return -1;
+  }
+  s->freemap[i / 64] |= mask;
+
+  slab **list = &PARTIAL[s->size / 8 - 1];
+  if (s->used-- == s->count) pushslab(list, s);
+  if (s->used == 0) {
+    unlinkslab(list, s);
+    s->next = EMPTY;
+    EMPTY = s;
+  }
+  unlockheap();
+  return 0;
+}
+
+//  CHUNK FUNCTIONS
+
+header *getchunkdata(chunk *c) {
+  return (header*) ((char*) c + chunkhsize);
+}
+
+/*
+  BUDDY chunks start on a multiple of twice their largest block so the
+  order bit of every block's address is the same as in its offset.
+  Other chunks only need the data of their first block on MINALIGN
+*/
+size_t getchunkalign(size_t size) {
+  if (ALGORITHM == BUDDY) return (size_t) 2 << getfloororder(size);
+  return MINALIGN;
+}
+
+/*
+  maps len bytes, with huge pages from hugetlbfs if asked for and
+  otherwise asking for transparent huge pages where they are used
+  returns MAP_FAILED if the memory could not be mapped
+*/
+void *mapmemory(size_t len) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (HUGEPAGES == HUGE_TLB) {
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    if (map != MAP_FAILED) return map;
+    logPrint("Error: no hugetlbfs pages, falling back to transparent huge pages.");
+  }
+  void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (map != MAP_FAILED && HUGEPAGES != HUGE_NONE) madvise(map, len, MADV_HUGEPAGE);
+  return map;
+}
+
+/*
+  mapchunk:
+  - map enough memory for the chunk descriptor, fences and size bytes of
+    blocks, with extra room to align the blocks if needed
+  - unmap whole pages of that extra room on either side
+  - with huge pages the chunk starts on a huge page and its blocks fill
+    out its last huge page, except under BUDDY where they were aligned
+    for size and keep it
+  returns NULL if the memory could not be mapped
+*/
+chunk *mapchunk(size_t size, size_t align) {
+  size_t granule = HUGEPAGES == HUGE_NONE ? (size_t) getpagesize() : HUGESIZE;
+  size_t slack = align > fsize ? align : 0;
+  size_t skew = ALGORITHM == BUDDY ? 0 : usedhsize; // BUDDY aligns headers, the rest their data
+  size_t maplen = alignbytes(chunkhsize + size + usedhsize + slack, granule);
+  if (HUGEPAGES != HUGE_NONE) maplen += granule;
+  char *map = mapmemory(maplen);
+  if (map == MAP_FAILED) return NULL;
+
+  char *first = (char*) alignbytes((size_t) map, granule);
+  char *data = (char*) alignbytes((size_t) first + chunkhsize + skew, align) - skew;
+  char *start = (char*) ((size_t) (data - chunkhsize) / granule * granule);
+  char *end = (char*) alignbytes((size_t) data + size + usedhsize, granule);
+  if (start > map) munmap(map, start - map);
+  if (end < map + maplen) munmap(end, map + maplen - end);
+  if (HUGEPAGES != HUGE_NONE && ALGORITHM != BUDDY) size = (end - data - usedhsize) / MINALIGN * MINALIGN;
+
+  chunk *c = (chunk*) (data - chunkhsize);
+  c->next = NULL;
+  c->map = start;
+  c->maplen = end - start;
+  c->size = size;
+  return c;
+}
+
+/*
+  addchunk:
+  - write the fences on either side of the chunk's blocks
+  - hand the blocks to the free structures of the current algorithm,
+    known to be zero if the chunk was just mapped
+  - append the chunk to CHUNKS
+*/
+void addchunk(chunk *c, bool fresh) {
+  header fence = makeheader(0, false, NULL, NULL);
+  header *data = getchunkdata(c);
+  header *lead = (header*) ((char*) data - usedhfsize);
+  memcpy(lead, &fence, usedhsize);
+  memcpy((char*) data + c->size, &fence, usedhsize);
+  setfooter(lead);
+
+  if (ALGORITHM == BUDDY) {
+    initbuddy((char*) data, c->size);
+  }
+  else {
+    *data = makeheader(c->size - hfsize, true, NULL, NULL);
+    setfooter(data);
+    if (fresh) setclean(data, (char*) data);
+    linkfree(data);
+  }
+
+  chunk **tail = &CHUNKS;
+  while (*tail != NULL) tail = &(*tail)->next;
+  *tail = c;
+  TOTAlSIZE += c->size;
+}
+
+/*
+  growheap:
+  - pick the size of the next chunk from the growth policy,
+    making sure the request fits in it
+  - map and add the chunk unless that would pass MAXHEAP
+  returns false if the heap could not grow
+*/
+bool growheap(size_t size) {
+  if (GROWTH == GROW_NONE) return false;
+
+  size_t page_size = getpagesize();
+  size_t need = size + usedhfsize;
+  if (ALGORITHM == BUDDY) need = (size_t) 1 << getorder(size + usedhfsize);
+  size_t chunksize = GROWTH == GROW_DOUBLE ? TOTAlSIZE : CHUNKSIZE;
+  if (chunksize < need) chunksize = need;
+  chunksize = alignbytes(chunksize, page_size);
+
+  if (MAXHEAP != 0 && TOTAlSIZE + chunksize > MAXHEAP) {
+    logPrint("Error: growing by %zu bytes would pass the heap limit.", chunksize);
+    return false;
+  }
+
+  chunk *c = mapchunk(chunksize, getchunkalign(chunksize));
+  if (c == NULL) {
+    logPrint("Error: could not map a new chunk of %zu bytes.", chunksize);
+    return false;
+  }
+  addchunk(c, true);
+  return true;
+}
+
+//  TRIM FUNCTIONS
+
+/*
+  unmapchunk:
+  - take every block of a completely free chunk off the free structures
+  - remove the chunk from CHUNKS and give its memory back to the OS
+  returns the number of bytes unmapped
+*/
+size_t unmapchunk(chunk *c) {
+  for (header *h = getchunkdata(c); h != NULL; h = getnextbysize(h)) {
+    unlinkfree(h);
+  }
+
+  chunk **link = &CHUNKS;
+  while (*link != c) link = &(*link)->next;
+  *link = c->next;
+  TOTAlSIZE -= c->size;
+
+  size_t maplen = c->maplen;
+  munmap(c->map, maplen);
+  return maplen;
+}
+
+/*
+  releases the pages strictly inside a free block. The header and
+  footer stay resident and the pages read back as zero when reused,
+  so zeroing the rest of the last page lets the block be known zero.
+  returns the number of bytes released
+*/
+size_t trimblock(header *h) {
+  size_t page_size = getpagesize();
+  char *start = (char*) alignbytes((size_t) (getcleanptr(h) + 1), page_size);
+  char *end = (char*) ((size_t) getfooter(h) / page_size * page_size);
+  if (end <= start) return 0;
+  if (madvise(start, end - start, MADV_DONTNEED) != 0) return 0;
+
+  char *clean = getclean(h);
+  if (clean == NULL || clean > end) memset(end, 0, (char*) getfooter(h) - end);
+  if (clean == NULL || clean > start) setclean(h, start);
+  return end - start;
+}
+
+bool ischunkfree(chunk *c) {
+  for (header *h = getchunkdata(c); h != NULL; h = getnextbysize(h)) {
+    if (!getfree(h)) return false;
+  }
+  return true;
+}
+
+/*
+  trims a block that was just freed, unmapping its whole chunk when it
+  was the last thing in use there. The initial region is never unmapped.
+*/
+size_t trimfree(header *h) {
+  if (getnextbysize(h) == NULL && h != BASE) {
+    // there is no footer before h to say it starts the chunk
+    for (chunk *c = CHUNKS; c != NULL; c = c->next) {
+      if (getchunkdata(c) == h) return unmapchunk(c);
+    }
+  }
+  return trimblock(h);
+}
+
+/*
+  trimheap:
+  - unmap every chunk other than the initial region that has nothing in use
+  - release the interior pages of every other free block
+  returns the number of bytes given back to the OS
+*/
+size_t trimheap(){
+  size_t released = 0;
+  lockheap();
+  chunk *c = CHUNKS;
+  while (c != NULL) {
+    chunk *next = c->next;
+    if (getchunkdata(c) != BASE && ischunkfree(c)) {
+      released += unmapchunk(c);
+    }
+    else {
+      for (header *h = getchunkdata(c); h != NULL; h = getnextbysize(h)) {
+        if (getfree(h)) released += trimblock(h);
+      }
+    }
+    c = next;
+  }
+  unlockheap();
+  return released;
+}
+
+//  LARGE FUNCTIONS
+
+/*
+  a large block is a used header followed by its payload in a mapping
+  of its own, so freeing it gives the memory straight back to the OS
+*/
+bool ismapped(header *h) {
+  return getsf(h) & MAPBIT;
+}
+
+/*
+  the header sits mapskew bytes into the mapping, after its mapping
+  and far enough in that the data after it is on MINALIGN
+*/
+mapping *getmapping(header *h) {
+  return (mapping*) ((char*) h - mapskew);
+}
+
+void linkmapping(mapping *m) {
+  m->prev = NULL;
+  m->next = MAPPINGS;
+  if (MAPPINGS != NULL) MAPPINGS->prev = m;
+  MAPPINGS = m;
+}
+
+void unlinkmapping(mapping *m) {
+  if (m->prev != NULL) m->prev->next = m->next;
+  else MAPPINGS = m->next;
+  if (m->next != NULL) m->next->prev = m->prev;
+}
+
+size_t getmaplen(size_t size) {
+  return alignbytes(mapskew + size + usedhsize, getpagesize());
+}
+
+/*
+  mapblock:
+  - map a large block with room for at least size bytes
+  returns NULL if the memory could not be mapped
+*/
+header *mapblock(size_t size) {
+  size_t maplen = getmaplen(size);
+  char *map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return NULL;
+  header *h = (header*) (map + mapskew);
+  *h = makeheader(maplen - mapskew - usedhsize, false, NULL, NULL);
+  h->sf |= MAPBIT;
+  lockheap();
+  linkmapping((mapping*) map);
+  unlockheap();
+  return h;
+}
+
+void unmapblock(header *h) {
+  lockheap();
+  unlinkmapping(getmapping(h));
+  unlockheap();
+  munmap(getmapping(h), mapskew + getsize(h) + usedhsize);
+}
+
+/*
+  unmaps every block of the current heap that has a mapping of its own
+*/
+void unmapblocks() {
+  mapping *m = MAPPINGS;
+  while (m != NULL) {
+    mapping *next = m->next;
+    header *h = (header*) ((char*) m + mapskew);
+    munmap(m, mapskew + getsize(h) + usedhsize);
+    m = next;
+  }
+  MAPPINGS = NULL;
+}
+
+/*
+  remapblock:
+  - resize a large block, letting the kernel move its pages rather
+    than copying them
+  returns NULL if the mapping could not be resized
+*/
+header *remapblock(header *h, size_t size) {
+  size_t maplen = getmaplen(size);
+  // the mapping can move, so it is off the list while it does
+  lockheap();
+  unlinkmapping(getmapping(h));
+  char *map = mremap(getmapping(h), mapskew + getsize(h) + usedhsize, maplen, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED) {
+    linkmapping(getmapping(h));
+    unlockheap();
+    return NULL;
+  }
+  linkmapping((mapping*) map);
+  unlockheap();
+  header *new = (header*) (map + mapskew);
+  new->sf = makefooter(maplen - mapskew - usedhsize, false) | MAPBIT | (new->sf & HEAPBITS);
+  return new;
+}
+
+//  TRACE FUNCTIONS
+
+#define TRACEBATCH (4096) // records buffered before they are written out
+#define TRACEKEEP (0)     // traceptr op that only updates the table
+
+/*
+  live pointers are mapped to the ids in the trace by an open addressing
+  table. The table and the record buffer are mapped directly so that
+  tracing never allocates from the heap it is recording
+*/
+typedef struct _traceslot {
+  void *ptr;
+  uint32_t id;
+} traceslot;
+
+int TRACEFD = -1;
+pthread_mutex_t TRACELOCK = PTHREAD_MUTEX_INITIALIZER;
+uint64_t TRACESTART;
+umemtracerec *TRACEBUF = NULL;
+size_t TRACELEN = 0;
+traceslot *TRACETABLE = NULL;
+size_t TRACESLOTS = 0;    // power of two
+size_t TRACELIVE = 0;
+uint32_t NEXTTRACEID = 0;
+uint16_t NEXTTRACETHREAD = 0;
+__thread uint16_t TRACETHREAD = 0; // 0 until the thread's first record
+
+uint64_t tracetime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec - TRACESTART;
+}
+
+size_t traceslotof(void *ptr) {
+  size_t hash = ((size_t) ptr >> 3) * 0x9e3779b97f4a7c15;
+  size_t i = hash & (TRACESLOTS - 1);
+  while (TRACETABLE[i].ptr != NULL && TRACETABLE[i].ptr != ptr) {
+    i = (i + 1) & (TRACESLOTS - 1);
+  }
+  return i;
+}
+
+bool growtracetable() {
+  size_t oldslots = TRACESLOTS;
+  traceslot *old = TRACETABLE;
+  size_t slots = oldslots == 0 ? 4096 : oldslots * 2;
+  traceslot *table = mmap(NULL, slots * sizeof(traceslot), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (table == MAP_FAILED) return false;
+  TRACETABLE = table;
+  TRACESLOTS = slots;
+  for (size_t i = 0; i < oldslots; i++) {
+    if (old[i].ptr != NULL) TRACETABLE[traceslotof(old[i].ptr)] = old[i];
+  }
+  if (old != NULL) munmap(old, oldslots * sizeof(traceslot));
+  return true;
+}
+
+/*
+  removing from linear probing moves later entries of the same run back
+  into the hole so that lookups never stop short
+*/
+void tracedelete(size_t i) {
+  TRACETABLE[i].ptr = NULL;
+  TRACELIVE--;
+  size_t j = i;
+  while (true) {
+    j = (j + 1) & (TRACESLOTS - 1);
+    if (TRACETABLE[j].ptr == NULL) return;
+    size_t home = (((size_t) TRACETABLE[j].ptr >> 3) * 0x9e3779b97f4a7c15) & (TRACESLOTS - 1);
+    // the entry at j can fill the hole unless its home lies after the hole
+    if (((j - home) & (TRACESLOTS - 1)) >= ((j - i) & (TRACESLOTS - 1))) {
+      TRACETABLE[i] = TRACETABLE[j];
+      TRACETABLE[j].ptr = NULL;
+      i = j;
+    }
+  }
+}
+
+bool flushtrace() {
+  char *buf = (char*) TRACEBUF;
+  size_t len = TRACELEN * sizeof(umemtracerec);
+  TRACELEN = 0;
+  while (len > 0) {
+    ssize_t n = write(TRACEFD, buf, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      logPrint("Error: could not write the trace, stopping it.");
+      TRACING = false;
+      return false;
+    }
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+void addtrace(int op, uint32_t id, size_t size) {
+  if (TRACETHREAD == 0) TRACETHREAD = ++NEXTTRACETHREAD;
+  TRACEBUF[TRACELEN++] = (umemtracerec) {
+    .time = tracetime(),
+    .size = size,
+    .id = id,
+    .thread = TRACETHREAD,
+    .op = op,
+  };
+  if (TRACELEN == TRACEBATCH) flushtrace();
+}
+
+/*
+  traceptr:
+  - record that ptr was handed out with size bytes, giving it the id of
+    the block it was reallocated from or a new one
+  - TRACEKEEP puts a pointer back under its id without recording anything
+*/
+void traceptr(int op, void *ptr, size_t size, uint32_t id) {
+  pthread_mutex_lock(&TRACELOCK);
+  if (TRACING && ((TRACELIVE + 1) * 2 <= TRACESLOTS || growtracetable())) {
+    if (op == UMEM_TRACE_ALLOC) id = NEXTTRACEID++;
+    size_t i = traceslotof(ptr);
+    if (TRACETABLE[i].ptr == NULL) TRACELIVE++;
+    TRACETABLE[i] = (traceslot) {ptr, id};
+    if (op != TRACEKEEP) addtrace(op, id, size);
+  }
+  pthread_mutex_unlock(&TRACELOCK);
+}
+
+/*
+  traceforget:
+  - record that ptr is about to be freed and drop it from the table
+  - pointers made before the trace started, and invalid ones, have no
+    id and are not recorded
+  returns the id the pointer had, or UINT32_MAX
+*/
+uint32_t traceforget(void *ptr, bool record) {
+  uint32_t id = UINT32_MAX;
+  pthread_mutex_lock(&TRACELOCK);
+  if (TRACING && ptr != NULL) {
+    size_t i = traceslotof(ptr);
+    if (TRACETABLE[i].ptr == ptr) {
+      id = TRACETABLE[i].id;
+      tracedelete(i);
+      if (record) addtrace(UMEM_TRACE_FREE, id, 0);
+    }
+  }
+  pthread_mutex_unlock(&TRACELOCK);
+  return id;
+}
+
+//  MAIN FUNCTIONS
+
+/*
+  umemtrimthreshold:
+  - free blocks of at least threshold bytes are trimmed as soon as
+    ufree creates them. 0 turns automatic trimming off
+  - applies to each arena and to heaps created afterwards
+*/
+int umemtrimthreshold(size_t threshold){
+  for (int i = 0; i < MAXARENAS; i++) {
+    ARENAS[i].trimthreshold = threshold;
+  }
+  return 0;
+}
+
+/*
+  umemtrim:
+  - trim every arena
+  returns the number of bytes given back to the OS
+*/
+size_t 	umemtrim(){
+  size_t released = 0;
+  for (int i = 0; i < NARENAS; i++) {
+    HEAP = &ARENAS[i];
+    released += trimheap();
+  }
+  return released;
+}
+
+/*
+  umemmapthreshold:
+  - umalloc requests of at least threshold bytes get a mapping of their
+    own instead of a block in the heap. 0 turns this off
+*/
+int umemmapthreshold(size_t threshold){
+  for (int i = 0; i < MAXARENAS; i++) {
+    ARENAS[i].mapthreshold = threshold;
+  }
+  return 0;
+}
+
+/*
+  umemgrowth:
+  - set how the heap grows once it runs out of space
+  - maxheap limits the total size of all chunks, 0 for no limit
+  - applies to each arena and to heaps created afterwards
+*/
+int umemgrowth(int policy, size_t maxheap){
+  if (policy < GROW_NONE || policy > GROW_DOUBLE){
+    logPrint("Error: unknown growth policy %d.", policy);
+    return -1;
+  }
+  for (int i = 0; i < MAXARENAS; i++) {
+    ARENAS[i].growth = policy;
+    ARENAS[i].maxheap = maxheap;
+  }
+  return 0;
+}
+
+/*
+  umemhugepages:
+  - set how chunks mapped from now on are backed by huge pages
+  - applies to each arena and to heaps created afterwards
+*/
+int umemhugepages(int mode){
+  if (mode < HUGE_NONE || mode > HUGE_TLB){
+    logPrint("Error: unknown huge page mode %d.", mode);
+    return -1;
+  }
+  for (int i = 0; i < MAXARENAS; i++) {
+    ARENAS[i].hugepages = mode;
+  }
+  return 0;
+}
+
+/*
+  umemarenas:
+  - set how many independent arenas umeminit splits the region between.
+    Threads are handed arenas round-robin, so this only helps THREAD_SAFE
+  - has to be called before umeminit
+*/
+int umemarenas(int narenas){
+  if (narenas < 1 || narenas > MAXARENAS){
+    logPrint("Error: narenas should be between 1 and %d.", MAXARENAS);
+    return -1;
+  }
+  if (ARENAS[0].base != NULL){
+    logPrint("Error: umemarenas called after umeminit.");
+    return -1;
+  }
+  NARENAS = narenas;
+  return 0;
+}
+
+/*
+  umemminalign:
+  - set the alignment of every pointer handed out, 8 by default or 16,
+    which is what malloc promises on 64 bit systems
+  - BUDDY blocks are aligned by their headers, so it can give no more
+    than the size of a used header
+  - has to be called before umeminit
+*/
+int umemminalign(size_t alignment){
+  if (alignment != 8 && alignment != 16){
+    logPrint("Error: alignment should be 8 or 16.");
+    return -1;
+  }
+  if (ARENAS[0].base != NULL){
+    logPrint("Error: umemminalign called after umeminit.");
+    return -1;
+  }
+  MINALIGN = alignment;
+  return 0;
+}
+
+/*
+  initheap:
+  - map the first chunk of the current heap and hand it to the free structures
+  returns -1 if the memory could not be mapped
+*/
+int initheap(size_t size, int allocationAlgo){
+  CHUNKSIZE = size;
+  ALGORITHM = allocationAlgo & ~(THREAD_SAFE | SLAB);
+  THREADSAFE = allocationAlgo & THREAD_SAFE;
+  pthread_mutex_init(&HEAPLOCK, NULL);
+
+  chunk *c = mapchunk(CHUNKSIZE, getchunkalign(CHUNKSIZE));
+  if (c == NULL) return -1;
+  addchunk(c, true);
+  BASE = getchunkdata(c);
+  starttop();
+  return 0;
+}
+
+/*
+  resetheap:
+  - unmap every chunk but the initial region, and every block with a
+    mapping of its own
+  - rewrite the initial region as one free block, as initheap does,
+    discarding every block in use at once
+*/
+void resetheap() {
+  chunk *c = CHUNKS;
+  for (chunk *next = c->next; next != NULL; ) {
+    chunk *after = next->next;
+    munmap(next->map, next->maplen);
+    next = after;
+  }
+  unmapblocks();
+
+  ROOT = CURR = HINT = TREE = TOP = NULL;
+  memset(BINS, 0, sizeof(BINS));
+  BINMAP = 0;
+  memset(FREECLASSES, 0, sizeof(FREECLASSES));
+  memset(CLASSBYTES, 0, sizeof(CLASSBYTES));
+  FREEBYTES = FREEBLOCKS = CLASSMAP = 0;
+  memset(PARTIAL, 0, sizeof(PARTIAL));
+  EMPTY = NULL;
+  if (SLABBED) SLABNEXT = SLABEND - SLABSPACE;
+  CHUNKS = NULL;
+  TOTAlSIZE = 0;
+  c->next = NULL;
+  addchunk(c, false);
+  starttop();
+}
+
+bool checkalgorithm(int allocationAlgo){
+  allocationAlgo &= ~(THREAD_SAFE | SLAB);
+  if (allocationAlgo < BEST_FIT || allocationAlgo > LIFO_FIT){
+    logPrint("Error: unknown allocation algorithm %d.", allocationAlgo);
+    return false;
+  }
+  return true;
+}
+
+/*
+  umeminit:
+  - request memory region of specified size and save addr to head
+  - create header with size (minus header size)
+  - write header to start of memory region
+  - save allocation algorithm
+  - with several arenas, each gets an equal share of the region
+  - with SLAB, reserve address space for the slabs of every arena
+*/
+int umeminit(size_t sizeOfRegion, int allocationAlgo){
+  // Parameter checking
+  if (sizeOfRegion == 0){
+    logPrint("Error: sizeOfRegion should be > 0.");
+    return -1;
+  }
+
+  if (!checkalgorithm(allocationAlgo)){
+    return -1;
+  }
+
+  if ((allocationAlgo & ~(THREAD_SAFE | SLAB)) == BUDDY && MINALIGN > usedhsize){
+    logPrint("Error: BUDDY cannot align to more than %d bytes.", (int) usedhsize);
+    return -1;
+  }
+
+  if (ARENAS[0].base != NULL){
+    logPrint("Error: umeminit called but memory has already been allocated.");
+    return -1;
+  }
+
+  // adjust sizeOfRegion to be a multiple of the page size
+  int page_size = getpagesize();
+  sizeOfRegion = alignbytes(sizeOfRegion / NARENAS + hfsize, page_size);
+
+  // Slab pages are only touched once they are used
+  if (allocationAlgo & SLAB) {
+    SLABBASE = mmap(NULL, NARENAS * SLABSPACE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (SLABBASE == MAP_FAILED) { perror("mmap"); exit(1); }
+    SLABLIMIT = SLABBASE + NARENAS * SLABSPACE;
+  }
+
+  // Request memory from OS and initialize free list with its first block
+  for (int i = 0; i < NARENAS; i++) {
+    HEAP = &ARENAS[i];
+    HEAP->id = i;
+    if (initheap(sizeOfRegion, allocationAlgo) != 0) { perror("mmap"); exit(1); }
+    if (allocationAlgo & SLAB) {
+      SLABBED = true;
+      SLABNEXT = SLABBASE + i * SLABSPACE;
+      SLABEND = SLABNEXT + SLABSPACE;
+    }
+  }
+  HEAP = &ARENAS[0];
+
+  return 0;
+}
+
+/*
+  umalloc:
+  - find open spot in list
+  - write two new headers:
+    - one for the requested memory
+    - one for the shrunken free space
+  - count over header to return pointer to empty space
+*/
+header *getfirstfit(size_t size){
+  header *h = ROOT;
+  size_t steps = 0;
+
+  // check for free block until end of free list
+  while (h != NULL) {
+    profilestep(steps);
+
+    // Block should have at least enough space for the requested block
+    if (getfree(h) && cmpsize(blocksize(h), size + usedhfsize) > -1){
+      break;
+    }
+
+    h = getnextbyptr(h);
+  }
+  profilewalk(steps);
+  return h;
+}
+
+header *getnextfit(size_t size){
+  if (CURR == NULL) CURR = ROOT;
+  if (CURR == NULL) return NULL;
+  header *h = CURR;
+  size_t steps = 0;
+
+  // check for free block until end of free list
+  do  {
+    profilestep(steps);
+    // Block should have at least enough space for the requested block
+    if (getfree(h) && cmpsize(blocksize(h), size + usedhfsize) > -1){
+      profilewalk(steps);
+      return h;
+    }
+
+    h = getnextbyptr(h);
+
+    if (h == NULL) {
+      h = ROOT;
+    }
+  } while (h != CURR);
+
+  profilewalk(steps);
+  return NULL;
+}
+
+/*
+  the smallest free block that fits the request is the lower bound
+  of the request size in TREE
+*/
+header *getbestfit(size_t size){
+  header *h = TREE;
+  header *bestfit = NULL;
+  size_t steps = 0;
+
+  while (h != NULL) {
+    profilestep(steps);
+    if (cmpsize(blocksize(h), size + usedhfsize) >= 0) {
+      bestfit = h;
+      h = h->next;
+    }
+    else {
+      h = h->prev;
+    }
+  }
+  profilewalk(steps);
+  return bestfit;
+}
+
+header *getworstfit(size_t size){
+  header *h = ROOT;
+
+  size_t biggestdiff = 0;
+  header *worstfit = NULL;
+  size_t steps = 0;
+
+  // check for free block until end of free list
+  while (h != NULL) {
+    profilestep(steps);
+    if (cmpsize(blocksize(h), size + usedhfsize) >= 0) {
+      size_t diff = blocksize(h) - (size + usedhfsize);
+      if (worstfit == NULL || diff > biggestdiff){
+        biggestdiff = diff;
+        worstfit = h;
+      }
+    }
+    h = getnextbyptr(h);
+  }
+  profilewalk(steps);
+  return worstfit;
+}
+
+header *getfit(size_t size){
+  header *h = NULL;
+  switch (ALGORITHM)
+  {
+  case FIRST_FIT:
+  case LIFO_FIT:
+    h = getfirstfit(size);
+    break;
+  case NEXT_FIT:
+    h = getnextfit(size);
+    break;
+  case BEST_FIT:
+    h = getbestfit(size);
+    break;
+  case WORST_FIT:
+    h = getworstfit(size);
+    break;
+  case SEGREGATED:
+    h = getsegregatedfit(size);
+    break;
+  case BUDDY:
+    h = getbuddyfit(size);
+    break;
+  default:
+    break;
+  }
+  return h;
+}
+
+/*
+  allocblock:
+  - size has already been rounded up by umalloc
+  - returns the header of a used block with at least size bytes,
+    or NULL if there is no room even after growing the heap
+*/
+header *allocblock(size_t size){
+  FRESH = NULL;
+
+  // Nothing has been freed yet, so the block is just the front of TOP
+  if (TOP != NULL) {
+    header *h = bumpalloc(size);
+    if (h != NULL) return h;
+    retiretop();
+  }
+
+  // Get next block based on allocation algorithm,
+  // growing the heap once if nothing fits
+  header *h = getfit(size);
+  if (h == NULL && growheap(size)) h = getfit(size);
+
+  // NULL indicates there was not enough space for the request
+  if (h == NULL){
+    return NULL;
+  }
+
+  // buddy blocks are split and marked used as they are found
+  if (ALGORITHM == BUDDY) return h;
+  
+  // Set requested block as not free FIRST in order to 
+  // account for header size changing 
+  header *hnext = getnextbyptr(h);
+  header *hprev = getprevbyptr(h);
+
+  // Size keyed free lists have to drop the block before its size changes
+  bool ordered = isaddressordered();
+  if (!ordered) unlinkfree(h);
+  else countfree(h, -1);
+  FRESH = getclean(h);
+
+  int cmp = cmpsize(blocksize(h), size + usedhfsize);
+
+  // Block fits the request and a new block 
+  if (cmp == 2) {
+
+    // create new requested block header
+    header requested = makeheader(
+      size,
+      false,
+      NULL,
       NULL
     );
 
@@ -539,12 +2080,20 @@ void *umalloc(size_t size){
 
     // place headers in memory and add footers
     header *reqptr = h;
-    *reqptr = requested;
+    putheader(reqptr, requested);
     setfooter(reqptr);
 
-    header *freeptr = getnextbysize(reqptr);
+    header *freeptr = (header*) ((char*) reqptr + blocksize(reqptr));
     *freeptr = newfree;
-    setfooter(h);
+    setfooter(freeptr);
+    setclean(freeptr, FRESH);
+    SPLITS++;
+
+    if (!ordered) {
+      linkfree(freeptr);
+      return h;
+    }
+    countfree(freeptr, 1);
 
     // Replace requested block with new block in free list
     if (hnext != NULL) hnext->prev = freeptr;
@@ -553,24 +2102,436 @@ void *umalloc(size_t size){
     if (ALGORITHM == NEXT_FIT && reqptr == CURR) {
       CURR = freeptr;
     }
+    if (HINT == h) HINT = freeptr;
   }
   else { 
     // block fits only the request. If there is extra space, it will 
     // remain as padding
 
+    // the footer turns into data, which FRESH says is zero
+    if (FRESH != NULL) *getfooter(h) = 0;
+
     // set block to used (also updates size to account for change in headers)
     setfree(h, false);
+    if (!ordered) return h;
+
+    // remove requested block from free list
+    if (hnext != NULL) hnext->prev = hprev;
+    if (hprev != NULL) hprev->next = hnext;
+    if (h == ROOT) ROOT = hnext;
+    if (ALGORITHM == NEXT_FIT && CURR == h){
+      CURR = getnextbyptr(h);
+    }
+    if (HINT == h) HINT = hprev != NULL ? hprev : hnext;
+  }
+
+  return h;
+}
+
+/*
+  freeblock:
+  - h has already been checked by ufree
+*/
+void freeblock(header *h) {
+  retiretop();
+  setfree(h, true);
+  if (ALGORITHM == BUDDY) {
+    h = buddyfree(h);
+  }
+  else if (!isaddressordered()) {
+    h = mergefree(h);
+  }
+  else {
+    addtofree(h);
+
+    // coalesce adjacent blocks
+    h = coalesce(h, getnextbysize(h));
+    h = coalesce(getprevbysize(h), h);
+  }
+
+  if (TRIMTHRESHOLD != 0 && blocksize(h) >= TRIMTHRESHOLD) {
+    trimfree(h);
+  }
+}
+
+/*
+  splittail:
+  - shrink the used block h to size bytes if what is left over makes a block
+  returns the left over block, in use, or NULL if h was not split
+*/
+header *splittail(header *h, size_t size) {
+  if (cmpsize(blocksize(h), size + usedhfsize) != 2) return NULL;
+
+  SPLITS++;
+  size_t left = blocksize(h) - size - usedhfsize;
+  // h is in use, so only its size changes; a whole header would run into the data
+  setsize(h, size);
+
+  header *tail = (header*) ((char*) h + blocksize(h));
+  *tail = makeheader(left - usedhfsize, false, NULL, NULL);
+  setfooter(tail);
+  return tail;
+}
+
+/*
+  shrinkblock:
+  - give the end of a used block back to the heap, joining TOP if it is next
+*/
+void shrinkblock(header *h, size_t size) {
+  header *tail = splittail(h, size);
+  if (tail == NULL) return;
+
+  header *hnext = getnextbysize(tail);
+  if (hnext != NULL && hnext == TOP) {
+    countfree(TOP, -1);
+    setfree(tail, true);
+    TOP = joinblocks(tail, hnext);
+    countfree(TOP, 1);
+  }
+  else {
+    freeblock(tail);
+  }
+}
+
+/*
+  growblock:
+  - grow a used block to size bytes by absorbing the free block after it
+  - the part of that block which is not needed stays free
+  returns false if the next block is not free or too small
+*/
+bool growblock(header *h, size_t size) {
+  header *hnext = getnextbysize(h);
+  if (hnext == NULL || !getfree(hnext)) return false;
+  size_t total = blocksize(h) + blocksize(hnext);
+  if (total < size + usedhfsize) return false;
+
+  bool top = hnext == TOP;
+  if (top) {
+    countfree(hnext, -1);
+    TOP = NULL;
+  }
+  else {
+    unlinkfree(hnext);
+  }
+  char *clean = getclean(hnext);
+  setsize(h, total - usedhfsize);
+
+  header *tail = splittail(h, size);
+  if (tail == NULL) return true;
+
+  // the tail is still whatever part of the next block was zero
+  setfree(tail, true);
+  setclean(tail, clean);
+  if (top) {
+    TOP = tail;
+    countfree(TOP, 1);
+  }
+  else {
+    freeblock(tail);
+  }
+  return true;
+}
+
+/*
+  alignblock:
+  - move the start of a used block forward so its payload is aligned,
+    freeing the slack in front as a block of its own
+  - free whatever is left after size bytes
+  returns the header of the aligned block
+*/
+header *alignblock(header *h, size_t alignment, size_t size) {
+  char *ptr = getptr(h);
+  if ((size_t) ptr % alignment != 0) {
+    // the slack has to be big enough to make a block
+    ptr = (char*) alignbytes((size_t) ptr + hfsize, alignment);
+    header *aligned = (header*) (ptr - usedhsize);
+    char *end = (char*) h + blocksize(h);
+
+    putheader(h, makeheader((char*) aligned - (char*) h - usedhfsize, false, NULL, NULL));
+    setfooter(h);
+    *aligned = makeheader(end - (char*) aligned - usedhfsize, false, NULL, NULL);
+    setfooter(aligned);
+
+    freeblock(h);
+    h = aligned;
+  }
+  shrinkblock(h, size);
+  return h;
+}
+
+/*
+  carveblocks:
+  - split a used block into count used blocks of size bytes in one pass,
+    the last one keeping any padding
+*/
+void carveblocks(header *h, size_t size, size_t count, void **out) {
+  char *end = (char*) h + blocksize(h);
+  for (size_t i = 0; i < count; i++) {
+    size_t bsize = i == count - 1 ? (size_t) (end - (char*) h) : size + usedhfsize;
+    putheader(h, makeheader(bsize - usedhfsize, false, NULL, NULL));
+    setfooter(h);
+    out[i] = getptr(h);
+    h = (header*) ((char*) h + bsize);
+  }
+}
+
+int cmpptr(const void *a, const void *b) {
+  char *x = *(char**) a;
+  char *y = *(char**) b;
+  return (x > y) - (x < y);
+}
+
+//  THREAD FUNCTIONS
+
+/*
+  threads are handed arenas round-robin the first time they need one
+*/
+heap *getarena() {
+  if (MYARENA < 0) {
+    MYARENA = __atomic_fetch_add(&NEXTARENA, 1, __ATOMIC_RELAXED) % NARENAS;
+  }
+  return &ARENAS[MYARENA];
+}
+
+/*
+  umemlockall:
+  - take the lock of every arena and of the trace, so that a fork
+    copies the heap while no other thread is part way through a call
+  - umemunlockall lets them go again, in the parent and in the child
+*/
+void umemlockall(){
+  pthread_mutex_lock(&TRACELOCK);
+  for (int i = 0; i < NARENAS; i++) {
+    HEAP = &ARENAS[i];
+    lockheap();
+  }
+}
+
+void umemunlockall(){
+  for (int i = NARENAS - 1; i >= 0; i--) {
+    HEAP = &ARENAS[i];
+    unlockheap();
+  }
+  pthread_mutex_unlock(&TRACELOCK);
+}
+
+/*
+  returns the size of the block allocblock would hand out for size,
+  so blocks are cached under the size they are requested with
+*/
+size_t getcachesize(size_t size) {
+  if (ALGORITHM == BUDDY) {
+    int order = getorder(size + usedhfsize);
+    if (order < MINORDER) order = MINORDER;
+    return ((size_t) 1 << order) - usedhfsize;
+  }
+  return size;
+}
+
+void cachepush(tcache *cache, header *h) {
+  int i = getsize(h) / 8;
+  h->next = cache->lists[i];
+  h->prev = (header*) cache;
+  cache->lists[i] = h;
+  cache->counts[i]++;
+}
+
+header *cachepop(tcache *cache, int i) {
+  header *h = cache->lists[i];
+  if (h == NULL) return NULL;
+  cache->lists[i] = h->next;
+  cache->counts[i]--;
+  h->prev = NULL;
+  return h;
+}
+
+/*
+  gives up to n blocks of list i back to the arenas that own them,
+  only taking a lock again when the owner changes
+*/
+void cachedrain(tcache *cache, int i, int n) {
+  heap *locked = NULL;
+  for (header *h; n-- > 0 && (h = cachepop(cache, i)) != NULL; ) {
+    if (locked != &ARENAS[getheapid(h)]) {
+      if (locked != NULL) unlockheap();
+      HEAP = locked = &ARENAS[getheapid(h)];
+      lockheap();
+    }
+    freeblock(h);
+  }
+  if (locked != NULL) unlockheap();
+}
+
+/*
+  runs when a thread exits so its cached blocks are not lost
+*/
+void cacheexit(void *arg) {
+  tcache *cache = arg;
+  for (int i = 0; i < NCACHES; i++) {
+    cachedrain(cache, i, cache->counts[i]);
+  }
+  cache->registered = false;
+}
+
+void makecachekey() {
+  pthread_key_create(&CACHEKEY, cacheexit);
+}
+
+tcache *getcache() {
+  tcache *cache = &TCACHE;
+  if (!cache->registered) {
+    pthread_once(&CACHEONCE, makecachekey);
+    pthread_setspecific(CACHEKEY, cache);
+    cache->registered = true;
+  }
+  unsigned resets = __atomic_load_n(&RESETS, __ATOMIC_RELAXED);
+  if (cache->resets != resets) {
+    // the cached blocks were discarded along with their arenas
+    memset(cache->lists, 0, sizeof(cache->lists));
+    memset(cache->counts, 0, sizeof(cache->counts));
+    cache->resets = resets;
+  }
+  return cache;
+}
+
+/*
+  arenaalloc:
+  - allocate from the thread's own arena, falling back to the
+    others in turn when it is full
+  - with a cache, fill it from the same arena under the same lock
+*/
+header *arenaalloc(size_t size, tcache *cache) {
+  int own = getarena()->id;
+  header *h = NULL;
+  for (int i = 0; h == NULL && i < NARENAS; i++) {
+    HEAP = &ARENAS[(own + i) % NARENAS];
+    lockheap();
+    h = allocblock(size);
+    for (int j = 1; cache != NULL && h != NULL && j < CACHEBATCH; j++) {
+      header *extra = allocblock(size);
+      if (extra == NULL) break;
+      if (getsize(extra) > CACHEMAX) {
+        // padding pushed the block out of the cached sizes
+        freeblock(extra);
+        break;
+      }
+      cachepush(cache, extra);
+    }
+    unlockheap();
+  }
+  return h;
+}
+
+/*
+  cachealloc:
+  - small requests are served from the thread's cache without locking
+  - on a miss, allocate a batch of blocks under one lock, return the
+    first and cache the rest
+  - large requests go straight to the heap under the lock
+*/
+void *cachealloc(size_t size) {
+  size = getcachesize(size);
+  bool cached = size <= CACHEMAX;
+  tcache *cache = cached ? getcache() : NULL;
+  header *h = cached ? cachepop(cache, size / 8) : NULL;
+  if (h == NULL) h = arenaalloc(size, cache);
+  return h == NULL ? NULL : getptr(h);
+}
+
+/*
+  cachefree:
+  - small blocks go back to the thread's cache, which drains a batch
+    to the heap once it holds CACHELIMIT blocks of that size
+  - large blocks are freed straight to the heap under the lock
+*/
+int cachefree(header *h) {
+  size_t size = getsize(h);
+  if (size > CACHEMAX) {
+    lockheap();
+    freeblock(h);
+    unlockheap();
+    return 0;
+  }
+
+  tcache *cache = getcache();
+  int i = size / 8;
+  if (h->prev == (header*) cache) {
+    for (header *node = cache->lists[i]; node != NULL; node = node->next) {
+      if (node == h) {
+        logPrint("Double free");
+        return -1;
+      }
+    }
+  }
+  cachepush(cache, h);
+  if (cache->counts[i] >= CACHELIMIT) cachedrain(cache, i, CACHEBATCH);
+  return 0;
+}
+
+/*
+  calls are counted against the calling thread's own arena, atomically
+  when other threads may be counting there too
+*/
+void countcall(size_t *counter, size_t n) {
+  if (ARENAS[0].threadsafe) __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+  else *counter += n;
+}
+
+void *countalloc(void *ptr) {
+  if (ptr != NULL) countcall(&getarena()->allocs, 1);
+  return ptr;
+}
+
+int countrelease(int rc) {
+  if (rc == 0) countcall(&getarena()->frees, 1);
+  return rc;
+}
+
+size_t getrequestsize(size_t size){
+  // Minimum size is the width of the prev ptr + next ptr + footer
+  // this way a used block can always be free'd without 
+  // changing the size of the block.
+  if (size < hfsize - usedhfsize) size = hfsize - usedhfsize;
+  // Also ensure that each pointer is aligned on 8-byte boundaries,
+  // and that the next block's data is on MINALIGN
+  size = alignbytes(size + usedhsize, MINALIGN) - usedhsize;
+  assert(size % 8 == 0);
+  return size;
+}
+
+/*
+  blockallocate:
+  - allocate size bytes from a block of the arena, never from a slab
+  - slab objects are only aligned to MINALIGN, so aligned requests come here
+*/
+void *blockallocate(size_t size){
+  size = getrequestsize(size);
+  if (MAPTHRESHOLD != 0 && size >= MAPTHRESHOLD) {
+    header *h = mapblock(size);
+    return countalloc(h == NULL ? NULL : getptr(h));
+  }
+  if (THREADSAFE) return countalloc(cachealloc(size));
 
-    // remove requested block from free list
-    if (hnext != NULL) hnext->prev = hprev;
-    if (hprev != NULL) hprev->next = hnext;
-    if (h == ROOT) ROOT = hnext;
-    if (ALGORITHM == NEXT_FIT && CURR == h){
-      CURR = getnextbyptr(h);
-    }
+  header *h = arenaalloc(size, NULL);
+  return countalloc(h == NULL ? NULL : getptr(h));
+}
+
+void *allocate(size_t size){
+  HEAP = getarena();
+  if (BASE == NULL) {
+    return NULL;
+  }
+  if (size <= 0) {
+    return NULL;
   }
 
-  return getptr(h);
+  if (SLABBED && size <= SLABMAX) {
+    lockheap();
+    void *ptr = slaballoc(alignbytes(size, MINALIGN));
+    unlockheap();
+    if (ptr != NULL) return countalloc(ptr);
+  }
+  return blockallocate(size);
 }
 
 /*
@@ -581,50 +2542,726 @@ void *umalloc(size_t size){
     - use prev pointer to get block before
     - use size to count to block after
     - update size of earlier block to sum of both
+  - modes without an address ordered list find both neighbours from the
+    boundary tags and insert the result without walking the heap
+  - trim the coalesced block if it is at least TRIMTHRESHOLD bytes
 */
-int ufree(void *ptr) {
-  if (BASE == NULL) {
+bool checkused(header *h){
+  if (h == NULL) {
+    // pointer is corrupted or not a valid pointer
+    logPrint("Invalid ptr");
+    return false;
+  }
+  if (getfree(h)){
+    // pointer is already free
+    logPrint("Double free");
+    return false;
+  }
+  return true;
+}
+
+int release(void *ptr) {
+  if (ARENAS[0].base == NULL) {
     return -1;
   }
   if (ptr == NULL) {
     return 0;
   }
+  if (isslab(ptr)) {
+    return countrelease(slabfree(ptr));
+  }
+
+  header *h = getheaderfromptr(ptr);
+  if (!checkused(h)) return -1;
+  if (getheapid(h) >= (uint32_t) NARENAS) {
+    // pointer belongs to a heap from umemcreate
+    logPrint("Invalid ptr");
+    return -1;
+  }
+  // the block goes back to the arena that owns it
+  HEAP = &ARENAS[getheapid(h)];
+  if (ismapped(h)) {
+    unmapblock(h);
+    return countrelease(0);
+  }
+
+  if (THREADSAFE) return countrelease(cachefree(h));
+
+  freeblock(h);
+  return countrelease(0);
+}
+
+/*
+  umalloc and ufree time themselves when PROFILE is set. Calls made
+  from inside the allocator go straight to allocate and release
+*/
+void *umalloc(size_t size){
+  uint64_t start = profilestart();
+  void *ptr = allocate(size);
+  profileend(ALLOCHIST, start);
+  if (TRACING && ptr != NULL) traceptr(UMEM_TRACE_ALLOC, ptr, size, 0);
+  return ptr;
+}
+
+int ufree(void *ptr) {
+  if (TRACING) traceforget(ptr, true);
+  uint64_t start = profilestart();
+  int rc = release(ptr);
+  profileend(FREEHIST, start);
+  return rc;
+}
+
+/*
+  urealloc:
+  - a NULL ptr is the same as umalloc, a size of 0 the same as ufree
+  - objects in slabs stay put while the size fits, and move otherwise
+  - large blocks are remapped while they stay over the map threshold
+  - shrink the block in place, freeing its tail
+  - grow the block in place when the block after it is free and big enough
+  - otherwise move the data to a new block and free the old one
+  BUDDY blocks are only kept when they are already big enough
+*/
+void *reallocate(void *ptr, size_t size){
+  if (ptr == NULL) {
+    return allocate(size);
+  }
+  if (size == 0) {
+    release(ptr);
+    return NULL;
+  }
+  if (ARENAS[0].base == NULL) {
+    return NULL;
+  }
+
+  size_t oldsize;
+  if (isslab(ptr)) {
+    // objects in slabs cannot change size
+    oldsize = getslab(ptr)->size;
+    if (size <= oldsize) return ptr;
+  }
+  else {
+    header *h = getheaderfromptr(ptr);
+    if (!checkused(h)) return NULL;
+    if (getheapid(h) >= (uint32_t) NARENAS) {
+      logPrint("Invalid ptr");
+      return NULL;
+    }
+
+    HEAP = &ARENAS[getheapid(h)];
+    size_t request = getrequestsize(size);
+    if (ismapped(h) && MAPTHRESHOLD != 0 && request >= MAPTHRESHOLD) {
+      h = remapblock(h, request);
+      return h == NULL ? NULL : getptr(h);
+    }
+    if (!ismapped(h)) {
+      bool inplace = getsize(h) >= request;
+      if (ALGORITHM != BUDDY) {
+        lockheap();
+        if (inplace) shrinkblock(h, request);
+        else inplace = growblock(h, request);
+        unlockheap();
+      }
+      if (inplace) return ptr;
+    }
+    oldsize = getsize(h);
+  }
+
+  void *newptr = allocate(size);
+  if (newptr == NULL) {
+    return NULL;
+  }
+  memcpy(newptr, ptr, oldsize < size ? oldsize : size);
+  release(ptr);
+  return newptr;
+}
+
+/*
+  a block keeps its id in the trace across urealloc, and one that cannot
+  be resized is put back under it
+*/
+void *urealloc(void *ptr, size_t size){
+  if (!TRACING) return reallocate(ptr, size);
+  uint32_t id = traceforget(ptr, size == 0);
+  void *newptr = reallocate(ptr, size);
+  if (ptr == NULL && newptr != NULL) traceptr(UMEM_TRACE_ALLOC, newptr, size, 0);
+  else if (id != UINT32_MAX && size != 0) {
+    if (newptr != NULL) traceptr(UMEM_TRACE_REALLOC, newptr, size, id);
+    else traceptr(TRACEKEEP, ptr, size, id);
+  }
+  return newptr;
+}
+
+/*
+  ucalloc:
+  - allocate nmemb * size bytes set to zero, or NULL if that overflows
+  - only clear the part of the block that is not already known to be
+    zero from being freshly mapped or trimmed
+*/
+void *zeroallocate(size_t nmemb, size_t size){
+  size_t total;
+  if (__builtin_mul_overflow(nmemb, size, &total)) {
+    return NULL;
+  }
+  HEAP = getarena();
+  if (BASE == NULL || total == 0) {
+    return NULL;
+  }
+
+  size_t request = getrequestsize(total);
+  if (MAPTHRESHOLD != 0 && request >= MAPTHRESHOLD) {
+    // a new mapping is already zero
+    header *h = mapblock(request);
+    return countalloc(h == NULL ? NULL : getptr(h));
+  }
+  if (THREADSAFE && getcachesize(request) <= CACHEMAX) {
+    // blocks in the thread caches have all been used before
+    void *ptr = cachealloc(request);
+    if (ptr != NULL) memset(ptr, 0, total);
+    return countalloc(ptr);
+  }
+
+  header *h = arenaalloc(request, NULL);
+  if (h == NULL) {
+    return NULL;
+  }
+  char *ptr = getptr(h);
+  char *clean = FRESH;
+  memset(ptr, 0, clean != NULL && clean < ptr + total ? (size_t) (clean - ptr) : total);
+  return countalloc(ptr);
+}
+
+void *ucalloc(size_t nmemb, size_t size){
+  void *ptr = zeroallocate(nmemb, size);
+  if (TRACING && ptr != NULL) traceptr(UMEM_TRACE_ALLOC, ptr, nmemb * size, 0);
+  return ptr;
+}
 
+/*
+  umemusablesize:
+  - the bytes that can be used at ptr, which can be more than were asked
+    for once the request is rounded up
+  returns 0 for NULL or a pointer that is not a used block
+*/
+size_t umemusablesize(void *ptr){
+  if (ptr == NULL || ARENAS[0].base == NULL) {
+    return 0;
+  }
+  if (isslab(ptr)) {
+    return getslab(ptr)->size;
+  }
   header *h = getheaderfromptr(ptr);
+  if (h == NULL || getfree(h)) {
+    return 0;
+  }
+  return getsize(h);
+}
 
+/*
+  umemalign:
+  - allocate size bytes whose address is a multiple of alignment, which
+    has to be a power of two
+  - take a block with room to spare and give back the slack on both sides
+  BUDDY payloads always start usedhsize bytes into an aligned block, so that
+  mode cannot align them any further
+*/
+void *alignallocate(size_t alignment, size_t size){
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    logPrint("Error: alignment should be a power of two.");
+    return NULL;
+  }
+  if (alignment <= MINALIGN) {
+    return allocate(size);
+  }
+  HEAP = getarena();
+  if (BASE == NULL || size == 0) {
+    return NULL;
+  }
+  if (ALGORITHM == BUDDY) {
+    if (alignment <= usedhsize) return blockallocate(size);
+    logPrint("Error: BUDDY cannot align to more than %d bytes.", (int) usedhsize);
+    return NULL;
+  }
+
+  size_t request = getrequestsize(size);
+  header *h = arenaalloc(getrequestsize(request + alignment + hfsize), NULL);
   if (h == NULL) {
-    // pointer is corrupted or not a valid pointer
-    logPrint("Invalid ptr");
+    return NULL;
+  }
+  HEAP = &ARENAS[getheapid(h)];
+  lockheap();
+  h = alignblock(h, alignment, request);
+  unlockheap();
+  return countalloc(getptr(h));
+}
+
+void *umemalign(size_t alignment, size_t size){
+  void *ptr = alignallocate(alignment, size);
+  if (TRACING && ptr != NULL) traceptr(UMEM_TRACE_ALLOC, ptr, size, 0);
+  return ptr;
+}
+
+/*
+  umallocbatch:
+  - allocate count blocks of size bytes into out under a single lock
+  - when one free block holds them all they are carved from it in one
+    pass, otherwise they are allocated one at a time
+  - blocks are not taken from or put in the thread caches
+  returns the number of blocks allocated, fewer than count if the heap ran out
+*/
+size_t umallocbatch(size_t size, size_t count, void **out){
+  HEAP = getarena();
+  if (BASE == NULL || size == 0 || count == 0) {
+    return 0;
+  }
+
+  size = getrequestsize(size);
+  size_t total;
+  if (__builtin_mul_overflow(size + usedhfsize, count, &total)) {
+    return 0;
+  }
+
+  lockheap();
+  header *h = ALGORITHM == BUDDY ? NULL : allocblock(total - usedhfsize);
+  size_t n = 0;
+  if (h != NULL) {
+    carveblocks(h, size, count, out);
+    n = count;
+  }
+  for (; n < count && (h = allocblock(size)) != NULL; n++) {
+    out[n] = getptr(h);
+  }
+  unlockheap();
+  countcall(&getarena()->allocs, n);
+  for (size_t i = 0; TRACING && i < n; i++) {
+    traceptr(UMEM_TRACE_ALLOC, out[i], size, 0);
+  }
+  return n;
+}
+
+/*
+  ufreebatch:
+  - free count pointers, sorting ptrs by address in place
+  - blocks next to each other are joined into one used block first,
+    so each run is freed and coalesced only once
+  - blocks bypass the thread caches, objects in slabs are freed one by one
+  returns -1 if any pointer was invalid, 0 otherwise
+*/
+int ufreebatch(void **ptrs, size_t count){
+  if (ARENAS[0].base == NULL) {
     return -1;
   }
-  if (getfree(h)){
-    // pointer is already free
-    logPrint("Double free");
+
+  for (size_t i = 0; TRACING && i < count; i++) {
+    traceforget(ptrs[i], true);
+  }
+  qsort(ptrs, count, sizeof(void*), cmpptr);
+  int rc = 0;
+  heap *locked = NULL;
+  for (size_t i = 0; i < count; ) {
+    if (ptrs[i] == NULL) {
+      i++;
+      continue;
+    }
+    if (isslab(ptrs[i])) {
+      // slabfree takes the lock itself
+      if (locked != NULL) unlockheap();
+      locked = NULL;
+      if (countrelease(slabfree(ptrs[i])) != 0) rc = -1;
+      i++;
+      continue;
+    }
+    header *h = getheaderfromptr(ptrs[i]);
+    bool valid = i == 0 || ptrs[i] != ptrs[i - 1];
+    if (!valid) logPrint("Double free");
+    if (!valid || !checkused(h) || getheapid(h) >= (uint32_t) NARENAS) {
+      rc = -1;
+      i++;
+      continue;
+    }
+    if (ismapped(h)) {
+      // unmapblock takes the lock itself
+      if (locked != NULL) unlockheap();
+      locked = NULL;
+      HEAP = &ARENAS[getheapid(h)];
+      unmapblock(h);
+      countrelease(0);
+      i++;
+      continue;
+    }
+
+    if (locked != &ARENAS[getheapid(h)]) {
+      if (locked != NULL) unlockheap();
+      HEAP = locked = &ARENAS[getheapid(h)];
+      lockheap();
+    }
+
+    // extend the run while the next pointer is the block right after it
+    char *end = (char*) h + blocksize(h);
+    size_t run = i;
+    for (i++; ALGORITHM != BUDDY && i < count && (char*) ptrs[i] == end + usedhsize; i++) {
+      header *hnext = (header*) end;
+      if (!checkmagic(hnext) || getfree(hnext) || isfence(hnext)) break;
+      end += blocksize(hnext);
+    }
+    putheader(h, makeheader(end - (char*) h - usedhfsize, false, NULL, NULL));
+    setfooter(h);
+    freeblock(h);
+    countcall(&getarena()->frees, i - run);
+  }
+  if (locked != NULL) unlockheap();
+  return rc;
+}
+
+/*
+  umemreset:
+  - discard every block of every arena at once, leaving the heap as
+    umeminit made it. Pointers from before the reset must not be used
+  - thread caches notice the reset the next time they are used
+*/
+int umemreset(){
+  if (ARENAS[0].base == NULL) {
     return -1;
   }
+  __atomic_fetch_add(&RESETS, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < NARENAS; i++) {
+    HEAP = &ARENAS[i];
+    lockheap();
+    resetheap();
+    unlockheap();
+  }
+  return 0;
+}
 
-  setfree(h, true);
-  addtofree(h);
+/*
+  returns the size of the largest free block from the top size class of
+  the heap: exact when the class holds one block, otherwise the mean size
+  of its blocks, which is never more than the largest
+*/
+size_t getlargestfree() {
+  if (CLASSMAP == 0) return 0;
+  int class = NBINS - 1 - __builtin_clzl(CLASSMAP);
+  return CLASSBYTES[class] / FREECLASSES[class];
+}
 
-  // coalesce adjacent blocks
-  h = coalesce(h, getnextbysize(h));
-  h = coalesce(getprevbysize(h), h);
-  
+/*
+  umemstats:
+  - add up the counters every arena keeps as it goes, so the cost does
+    not depend on how many blocks there are
+  - blocks held in thread caches count as in use, and large blocks and
+    slabs are outside the heap
+*/
+umeminfo umemstats(){
+  umeminfo info = {0};
+  for (int i = 0; i < NARENAS && ARENAS[0].base != NULL; i++) {
+    HEAP = &ARENAS[i];
+    lockheap();
+    info.heapsize += TOTAlSIZE;
+    info.free += FREEBYTES;
+    info.freeblocks += FREEBLOCKS;
+    for (int k = 0; k < NBINS; k++) {
+      info.freeclasses[k] += FREECLASSES[k];
+    }
+    size_t largest = getlargestfree();
+    if (largest > info.largestfree) info.largestfree = largest;
+    info.splits += SPLITS;
+    info.coalesces += COALESCES;
+    unlockheap();
+    info.allocs += __atomic_load_n(&HEAP->allocs, __ATOMIC_RELAXED);
+    info.frees += __atomic_load_n(&HEAP->frees, __ATOMIC_RELAXED);
+  }
+
+  info.inuse = info.heapsize - info.free;
+  if (info.free != 0) info.fragmentation = 1 - (double) info.largestfree / info.free;
+  return info;
+}
+
+/*
+  umemtrace:
+  - start writing a umemtracerec to fd for every allocation and free
+    made through the public calls, from any thread
+  - blocks are numbered from 0 in the order they are handed out and
+    keep their number across urealloc
+  - a fd of -1 flushes the records still buffered and stops the trace
+  returns -1 if a trace is already running, or if nothing is being
+  traced or the last records could not be written when stopping
+*/
+int 	umemtrace(int fd){
+  pthread_mutex_lock(&TRACELOCK);
+  int rc = 0;
+  if (fd >= 0) {
+    if (TRACEBUF == NULL) {
+      void *buf = mmap(NULL, TRACEBATCH * sizeof(umemtracerec), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (buf != MAP_FAILED) TRACEBUF = buf;
+    }
+    if (TRACING || TRACEBUF == NULL) {
+      rc = -1;
+    }
+    else {
+      TRACEFD = fd;
+      TRACELEN = 0;
+      NEXTTRACEID = 0;
+      TRACESTART = 0;
+      TRACESTART = tracetime();
+      TRACING = true;
+    }
+  }
+  else if (TRACEFD < 0) {
+    rc = -1;
+  }
+  else {
+    if (!TRACING || !flushtrace()) rc = -1;
+    TRACING = false;
+    TRACEFD = -1;
+    if (TRACETABLE != NULL) munmap(TRACETABLE, TRACESLOTS * sizeof(traceslot));
+    TRACETABLE = NULL;
+    TRACESLOTS = 0;
+    TRACELIVE = 0;
+  }
+  pthread_mutex_unlock(&TRACELOCK);
+  return rc;
+}
+
+/*
+  umemprofile:
+  - copy the latency and free list walk histograms into out
+  - clock ticks are TSC cycles on x86 and nanoseconds elsewhere
+  returns -1 when the allocator was built without PROFILE
+*/
+int 	umemprofile(umemlatency *out){
+  if (!PROFILE || out == NULL) return -1;
+  umemhist *from[] = {&ALLOCHIST, &FREEHIST, &WALKHIST};
+  umemhist *to[] = {&out->alloc, &out->free, &out->walk};
+  for (int i = 0; i < 3; i++) {
+    to[i]->count = __atomic_load_n(&from[i]->count, __ATOMIC_RELAXED);
+    to[i]->sum = __atomic_load_n(&from[i]->sum, __ATOMIC_RELAXED);
+    for (int k = 0; k < 64; k++) {
+      to[i]->buckets[k] = __atomic_load_n(&from[i]->buckets[k], __ATOMIC_RELAXED);
+    }
+  }
+  return 0;
+}
+
+void 	umemprofilereset(){
+  memset(&ALLOCHIST, 0, sizeof(umemhist));
+  memset(&FREEHIST, 0, sizeof(umemhist));
+  memset(&WALKHIST, 0, sizeof(umemhist));
+}
+
+/*
+  umempercentile:
+  - find the bucket holding the sample at fraction q of the way through
+    hist, e.g. 0.99 for p99
+  returns the largest value that bucket can hold, or 0 for an empty hist
+*/
+uint64_t	umempercentile(const umemhist *hist, double q){
+  if (hist == NULL || hist->count == 0) return 0;
+  if (q < 0) q = 0;
+  if (q > 1) q = 1;
+  uint64_t rank = (uint64_t) (q * hist->count);
+  if (rank < q * hist->count || rank == 0) rank++;
+  uint64_t seen = 0;
+  int k = 0;
+  while (k < 63) {
+    seen += hist->buckets[k];
+    if (seen >= rank) break;
+    k++;
+  }
+  return k == 63 ? UINT64_MAX : ((uint64_t) 2 << k) - 1;
+}
+
+/*
+  umemwalk:
+  - visit every block of every arena, free and used, in physical order
+    chunk by chunk, handing cb the block's address, usable size and state
+  - each arena is locked while it is walked, so cb must not call back
+    into the allocator
+  returns 0 after the last block, or the first nonzero value cb returns
+*/
+int 	umemwalk(umemwalker cb, void *ctx){
+  if (cb == NULL) return -1;
+  for (int i = 0; i < NARENAS; i++) {
+    HEAP = &ARENAS[i];
+    lockheap();
+    for (chunk *c = CHUNKS; c != NULL; c = c->next) {
+      for (header *h = getchunkdata(c); h != NULL; h = getnextbysize(h)) {
+        umemblock block = {
+          .addr = h,
+          .ptr = getptr(h),
+          .size = getsize(h),
+          .free = getfree(h),
+          .arena = i,
+        };
+        int rc = cb(&block, ctx);
+        if (rc != 0) {
+          unlockheap();
+          return rc;
+        }
+      }
+    }
+    unlockheap();
+  }
+  return 0;
+}
+
+typedef struct _dumpbuf {
+  umemrecord *records;
+  size_t len;             // records that fit in the buffer
+  size_t n;               // records seen so far
+} dumpbuf;
+
+int dumprecord(const umemblock *block, void *ctx){
+  dumpbuf *d = ctx;
+  if (d->n < d->len) {
+    d->records[d->n] = (umemrecord) {
+      .addr = (uint64_t) (uintptr_t) block->addr,
+      .size = block->size,
+      .flags = block->free ? UMEM_RECORD_FREE : 0,
+      .arena = block->arena,
+    };
+  }
+  d->n++;
+  return 0;
+}
+
+/*
+  umemdumpbin:
+  - write one fixed size umemrecord per block, in umemwalk order, into
+    buf for as many records as fit in len bytes
+  returns the bytes the whole dump needs, so a call with len 0 sizes
+  the buffer
+*/
+size_t 	umemdumpbin(void *buf, size_t len){
+  dumpbuf d = {.records = buf, .len = buf == NULL ? 0 : len / sizeof(umemrecord)};
+  umemwalk(dumprecord, &d);
+  return d.n * sizeof(umemrecord);
+}
+
+int dumpfree(const umemblock *block, void *ctx){
+  int *n = ctx;
+  if (block->free) {
+    printf("%d\t%p\t%ld\t%d\n", (*n)++, block->addr, block->size, block->free);
+  }
   return 0;
 }
 
 /*
   umemdump:
-  - iterate over linked list (using size info) of blocks
+  - walk the blocks in every arena
   - print free block sizes and addresses
   format: '[block number]\t[address]\t[size]\t[free]'
 */
 void 	umemdump(){
   int n = 0;
-  header *block = ROOT;
-  while (block != NULL) {
-    printf("%d\t%p\t%ld\t%d\n", n++, block, getsize(block), getfree(block));
-    block = getnextbyptr(block);
-  }
+  umemwalk(dumpfree, &n);
   fflush(stdout);
-}
\ No newline at end of file
+}
+
+//  HEAP FUNCTIONS
+
+/*
+  umemcreate:
+  - make a heap that is independent of the one from umeminit and of
+    every other heap, using the growth and trim settings in effect
+  - the heap descriptor gets its own mapping so destroying the heap
+    never has to touch its blocks
+  returns NULL if the parameters are invalid or there is no memory
+*/
+umemheap *umemcreate(size_t sizeOfRegion, int allocationAlgo){
+  if (sizeOfRegion == 0){
+    logPrint("Error: sizeOfRegion should be > 0.");
+    return NULL;
+  }
+  if (!checkalgorithm(allocationAlgo)){
+    return NULL;
+  }
+
+  heap *hp = mmap(NULL, sizeof(heap), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (hp == MAP_FAILED) return NULL;
+  hp->id = MAXARENAS + __atomic_fetch_add(&NEXTHEAPID, 1, __ATOMIC_RELAXED) % (NHEAPIDS - MAXARENAS);
+  hp->growth = ARENAS[0].growth;
+  hp->hugepages = ARENAS[0].hugepages;
+  hp->maxheap = ARENAS[0].maxheap;
+  hp->trimthreshold = ARENAS[0].trimthreshold;
+
+  HEAP = hp;
+  int page_size = getpagesize();
+  if (initheap(alignbytes(sizeOfRegion + hfsize, page_size), allocationAlgo) != 0) {
+    munmap(hp, sizeof(heap));
+    return NULL;
+  }
+  return hp;
+}
+
+void *umemalloc(umemheap *hp, size_t size){
+  if (hp == NULL || size == 0) {
+    return NULL;
+  }
+  HEAP = hp;
+  size = getrequestsize(size);
+
+  lockheap();
+  header *h = allocblock(size);
+  unlockheap();
+  return h == NULL ? NULL : getptr(h);
+}
+
+int umemfree(umemheap *hp, void *ptr){
+  if (hp == NULL) {
+    return -1;
+  }
+  if (ptr == NULL) {
+    return 0;
+  }
+
+  header *h = getheaderfromptr(ptr);
+  if (!checkused(h)) return -1;
+  if (getheapid(h) != hp->id) {
+    logPrint("Pointer belongs to another heap");
+    return -1;
+  }
+
+  HEAP = hp;
+  lockheap();
+  freeblock(h);
+  unlockheap();
+  return 0;
+}
+
+/*
+  umemclear:
+  - discard every block of the heap at once, as umemreset does
+*/
+int umemclear(umemheap *hp){
+  if (hp == NULL) {
+    return -1;
+  }
+  HEAP = hp;
+  lockheap();
+  resetheap();
+  unlockheap();
+  return 0;
+}
+
+/*
+  umemdestroy:
+  - unmap every chunk and mapped block of the heap, discarding all of
+    its blocks at once
+  - the heaps from umeminit cannot be destroyed
+*/
+int umemdestroy(umemheap *hp){
+  if (hp == NULL || hp->id < MAXARENAS) {
+    return -1;
+  }
+
+  chunk *c = hp->chunks;
+  while (c != NULL) {
+    chunk *next = c->next;
+    munmap(c->map, c->maplen);
+    c = next;
+  }
+  HEAP = hp;
+  unmapblocks();
+  pthread_mutex_destroy(&hp->lock);
+  munmap(hp, sizeof(heap));
+  return 0;
+}
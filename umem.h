@@ -2,16 +2,119 @@
 #define _UMEM_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define BEST_FIT (1)
 #define WORST_FIT (2)
 #define FIRST_FIT (3)
 #define NEXT_FIT (4)
 #define BUDDY	(5)
+#define SEGREGATED (6)
+#define LIFO_FIT (7)
+#define THREAD_SAFE (1 << 8) // or'd with the algorithm to allow calls from many threads
+#define SLAB (1 << 9)        // or'd with the algorithm to serve umalloc requests up to 64 bytes from slabs
+
+#define GROW_NONE (0)   // never map more memory than the initial region
+#define GROW_FIXED (1)  // map chunks the size of the initial region
+#define GROW_DOUBLE (2) // map chunks as large as the whole heap so far
+
+#define HUGE_NONE (0)   // map chunks with ordinary pages
+#define HUGE_THP (1)    // align chunks to 2MB and ask for transparent huge pages
+#define HUGE_TLB (2)    // map chunks from hugetlbfs, falling back to HUGE_THP
+
+typedef struct _heap umemheap;
+
+typedef struct _umeminfo {
+  size_t heapsize;          // bytes available to blocks across all chunks
+  size_t inuse;             // bytes in used blocks, headers included
+  size_t free;              // bytes in free blocks, headers included
+  size_t freeblocks;
+  size_t largestfree;       // size of the largest free block, or the mean size of the
+                            // free blocks in its power of two class when it is not alone there
+  size_t freeclasses[64];   // free blocks of at least 2^k and less than 2^(k+1) bytes
+  size_t allocs;            // successful allocations, counting each block of a batch
+  size_t frees;             // successful frees, counting each block of a batch
+  size_t splits;            // blocks split in two
+  size_t coalesces;         // pairs of blocks joined into one
+  double fragmentation;     // 1 - largestfree / free
+} umeminfo;
+
+typedef struct _umemhist {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t buckets[64];     // samples of at least 2^k and less than 2^(k+1), with 0 in bucket 0
+} umemhist;
+
+typedef struct _umemlatency {  // filled by umemprofile in builds with -DPROFILE=true
+  umemhist alloc;           // umalloc latency in clock ticks
+  umemhist free;            // ufree latency in clock ticks
+  umemhist walk;            // blocks looked at by each free list search
+} umemlatency;
+
+#define UMEM_TRACE_ALLOC (1)   // umalloc, ucalloc, umemalign or umallocbatch
+#define UMEM_TRACE_FREE (2)    // ufree or ufreebatch, or urealloc to 0 bytes
+#define UMEM_TRACE_REALLOC (3) // urealloc of a traced block, which keeps its id
+
+typedef struct _umemtracerec {  // 24 bytes per call in a umemtrace file
+  uint64_t time;            // nanoseconds since the trace started
+  uint64_t size;            // bytes asked for, 0 for a free
+  uint32_t id;              // block number, in the order blocks were handed out
+  uint16_t thread;          // calling thread, numbered from 1
+  uint8_t op;
+  uint8_t pad;
+} umemtracerec;
+
+typedef struct _umemblock {
+  void *addr;               // block header, as printed by umemdump
+  void *ptr;                // pointer umalloc hands out for the block
+  size_t size;              // usable bytes
+  int free;
+  int arena;
+} umemblock;
+
+typedef int (*umemwalker)(const umemblock *block, void *ctx); // nonzero stops the walk
+
+#define UMEM_RECORD_FREE (1) // umemrecord flag for a free block
+
+typedef struct _umemrecord {  // 24 bytes per block in a umemdumpbin dump
+  uint64_t addr;
+  uint64_t size;
+  uint32_t flags;
+  uint32_t arena;
+} umemrecord;
 
 int 	umeminit(size_t sizeOfRegion, int allocationAlgo);
+int 	umemgrowth(int policy, size_t maxheap);
+int 	umemarenas(int narenas);
+int 	umemminalign(size_t alignment);
+int 	umemhugepages(int mode);
+int 	umemtrimthreshold(size_t threshold);
+int 	umemmapthreshold(size_t threshold);
+size_t 	umemtrim();
+int 	umemreset();
+void 	umemlockall();
+void 	umemunlockall();
 void 	*umalloc(size_t size);
 int 	ufree(void *ptr);
+void 	*urealloc(void *ptr, size_t size);
+void 	*ucalloc(size_t nmemb, size_t size);
+void 	*umemalign(size_t alignment, size_t size);
+size_t 	umemusablesize(void *ptr);
+size_t 	umallocbatch(size_t size, size_t count, void **out);
+int 	ufreebatch(void **ptrs, size_t count);
 void 	umemdump();
+int 	umemwalk(umemwalker cb, void *ctx);
+size_t 	umemdumpbin(void *buf, size_t len);
+umeminfo	umemstats();
+int 	umemtrace(int fd);
+int 	umemprofile(umemlatency *out);
+void 	umemprofilereset();
+uint64_t	umempercentile(const umemhist *hist, double q);
+
+umemheap	*umemcreate(size_t sizeOfRegion, int allocationAlgo);
+void 	*umemalloc(umemheap *heap, size_t size);
+int 	umemfree(umemheap *heap, void *ptr);
+int 	umemclear(umemheap *heap);
+int 	umemdestroy(umemheap *heap);
 
 #endif